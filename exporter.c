@@ -0,0 +1,529 @@
+/*
+ * exporter.c
+ *      Background worker sending logs to a local collector through a Unix
+ *      socket or a FIFO.
+ *
+ * Copyright (c) 2018, Postgres Professional
+ */
+#include "postgres.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "utils/guc.h"
+#include "utils/json.h"
+
+#include "pg_logging.h"
+
+/* batches waiting for the collector, in batch sizes */
+#define EXPORT_MAX_PENDING	4
+
+/* version of binary frames, see append_binary_item */
+#define EXPORT_BINARY_VERSION	1
+
+PGDLLEXPORT void pg_logging_exporter_main(Datum main_arg);
+
+static volatile sig_atomic_t got_sigterm = false;
+static volatile sig_atomic_t got_sighup = false;
+
+static int	export_fd = -1;
+
+static void
+exporter_sigterm(SIGNAL_ARGS)
+{
+	int		save_errno = errno;
+
+	got_sigterm = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+static void
+exporter_sighup(SIGNAL_ARGS)
+{
+	int		save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+void
+register_exporter(void)
+{
+	BackgroundWorker	worker;
+
+	MemSet(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+	worker.bgw_restart_time = 10;
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_logging exporter");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pg_logging exporter");
+#endif
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_logging");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "pg_logging_exporter_main");
+	worker.bgw_notify_pid = 0;
+
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Opens the FIFO or connects to the socket. Both are non-blocking, so a slow
+ * collector can't stop the worker.
+ */
+static bool
+exporter_connect(void)
+{
+	struct stat		st;
+	int				fd;
+
+	if (stat(export_path_setting, &st) != 0)
+		return false;
+
+	if (S_ISFIFO(st.st_mode))
+	{
+		/* fails if nobody reads the FIFO yet */
+		fd = open(export_path_setting, O_WRONLY | O_NONBLOCK);
+		if (fd < 0)
+			return false;
+	}
+	else if (S_ISSOCK(st.st_mode))
+	{
+		struct sockaddr_un	addr;
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return false;
+
+		MemSet(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strlcpy(addr.sun_path, export_path_setting, sizeof(addr.sun_path));
+		if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+				!pg_set_noblock(fd))
+		{
+			close(fd);
+			return false;
+		}
+	}
+	else
+		return false;
+
+	export_fd = fd;
+	elog(LOG, "pg_logging exporter connected to \"%s\"", export_path_setting);
+	return true;
+}
+
+static void
+exporter_disconnect(StringInfo out)
+{
+	close(export_fd);
+	export_fd = -1;
+
+	/* the batch will be sent again from its start to a new connection */
+	out->cursor = 0;
+	elog(LOG, "pg_logging exporter disconnected from \"%s\"", export_path_setting);
+}
+
+/*
+ * Copies items which were not exported yet from the rings, until `limit`
+ * bytes are taken. Only complete items are taken, and the rings are locked
+ * only while copying. Items evicted before they were exported are counted
+ * as dropped.
+ */
+static int
+fetch_items(StringInfo raw, int limit)
+{
+	int		nitems = 0;
+	int		i;
+
+	for (i = 0; i < hdr->nrings && raw->len < limit; i++)
+	{
+		LogRing	   *ring = &hdr->rings[i];
+		char	   *ringdata = RING_DATA(ring);
+		uint64		seq;
+
+		RING_LOCK(ring);
+		seq = ring->export_seq;
+		if (seq < ring->first_seq)
+		{
+			pg_atomic_fetch_add_u64(&hdr->export_dropped, ring->first_seq - seq);
+			seq = ring->first_seq;
+		}
+
+		for (; seq < ring->next_seq && raw->len < limit; seq++)
+		{
+			ItemSummary	   *summary = RING_SUMMARY(ring, seq);
+			int				part1;
+
+			if (summary->written != (uint32) seq)
+				break;
+
+			pg_read_barrier();
+			part1 = Min(summary->totallen, ring->buffer_size - summary->pos);
+			appendBinaryStringInfo(raw, ringdata + summary->pos, part1);
+			appendBinaryStringInfo(raw, ringdata, summary->totallen - part1);
+			nitems++;
+		}
+		ring->export_seq = seq;
+		RING_RELEASE(ring);
+	}
+
+	return nitems;
+}
+
+static void
+append_json_text(StringInfo out, const char *key, const char *data, int len)
+{
+	char   *text;
+
+	if (len == 0)
+		return;
+
+	text = pnstrdup(data, len);
+	appendStringInfo(out, ",\"%s\":", key);
+	escape_json(out, text);
+	pfree(text);
+}
+
+static void
+append_json_item(StringInfo out, CollectedItem *item)
+{
+	const char *data = item->data;
+
+#define JSON_TEXT(key, len) \
+do { \
+	append_json_text(out, (key), data, (len)); \
+	data += (len); \
+} while (0)
+
+	appendStringInfo(out, "{\"log_time\":\"%s\"", timestamptz_to_str(item->logtime));
+	appendStringInfo(out, ",\"level\":%d,\"pid\":%d,\"line_num\":" UINT64_FORMAT,
+					 item->elevel, item->ppid, item->log_line_number);
+	appendStringInfo(out, ",\"datid\":%u,\"userid\":%u,\"errno\":%d",
+					 item->database_id, item->user_id, item->saved_errno);
+	if (TransactionIdIsValid(item->txid))
+		appendStringInfo(out, ",\"txid\":%u", item->txid);
+	if (item->repeat_count > 0)
+	{
+		appendStringInfo(out, ",\"repeat_count\":%u", item->repeat_count);
+		appendStringInfo(out, ",\"last_log_time\":\"%s\"",
+						 timestamptz_to_str(item->last_logtime));
+	}
+
+	if (item->flags & ITEM_MESSAGE_IS_TEMPLATE)
+	{
+		const char *tmpl = get_interned_string(item->template_id);
+
+		append_json_text(out, "message", tmpl, strlen(tmpl));
+	}
+
+	/* ordering is important, look pg_logging.c !! */
+	JSON_TEXT("message", item->message_len);
+	JSON_TEXT("detail", item->detail_len);
+	JSON_TEXT("detail_log", item->detail_log_len);
+	JSON_TEXT("hint", item->hint_len);
+	JSON_TEXT("context", item->context_len);
+	JSON_TEXT("domain", item->domain_len);
+	JSON_TEXT("context_domain", item->context_domain_len);
+	JSON_TEXT("internalquery", item->internalquery_len);
+	JSON_TEXT("errstate", item->errstate_len);
+	JSON_TEXT("appname", item->appname_len);
+	JSON_TEXT("remote_host", item->remote_host_len);
+	JSON_TEXT("command_tag", item->command_tag_len);
+	JSON_TEXT("vxid", item->vxid_len);
+	JSON_TEXT("query", item->query_len);
+	JSON_TEXT("schema_name", item->schema_name_len);
+	JSON_TEXT("table_name", item->table_name_len);
+	JSON_TEXT("column_name", item->column_name_len);
+	JSON_TEXT("datatype_name", item->datatype_name_len);
+	JSON_TEXT("constraint_name", item->constraint_name_len);
+
+	if (item->filename_id)
+	{
+		const char *filename = get_interned_string(item->filename_id);
+
+		append_json_text(out, "filename", filename, strlen(filename));
+		appendStringInfo(out, ",\"lineno\":%d", item->lineno);
+	}
+	if (item->funcname_id)
+	{
+		const char *funcname = get_interned_string(item->funcname_id);
+
+		append_json_text(out, "funcname", funcname, strlen(funcname));
+	}
+	if (item->template_id)
+	{
+		const char *tmpl = get_interned_string(item->template_id);
+
+		append_json_text(out, "message_template", tmpl, strlen(tmpl));
+	}
+
+	appendStringInfoString(out, "}\n");
+#undef JSON_TEXT
+}
+
+static void
+append_uint32(StringInfo out, uint32 val)
+{
+	val = htonl(val);
+	appendBinaryStringInfo(out, (char *) &val, sizeof(val));
+}
+
+static void
+append_uint64(StringInfo out, uint64 val)
+{
+	append_uint32(out, (uint32) (val >> 32));
+	append_uint32(out, (uint32) val);
+}
+
+/* microseconds since the Unix epoch, or zero if the time is not set */
+static void
+append_binary_time(StringInfo out, TimestampTz t)
+{
+	if (t != 0)
+		t += (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY;
+	append_uint64(out, (uint64) t);
+}
+
+static void
+append_binary_text(StringInfo out, const char *data, int len)
+{
+	append_uint32(out, len);
+	appendBinaryStringInfo(out, data, len);
+}
+
+static void
+append_binary_string(StringInfo out, const char *str)
+{
+	append_binary_text(out, str, str ? strlen(str) : 0);
+}
+
+/*
+ * Binary frame, all numbers are in network byte order:
+ *
+ *     uint32 length of the rest of the frame
+ *     uint8  version of the format (EXPORT_BINARY_VERSION)
+ *     int64  log_time, int64 start_time (microseconds since the Unix epoch)
+ *     int32  level, int32 pid, int64 line_num, uint32 datid, uint32 userid,
+ *     int32  errno, uint32 txid, int32 query_pos, int32 internalpos,
+ *     int32  lineno, uint32 repeat_count, int64 last_log_time
+ *
+ * followed by 22 texts in the order of append_binary_item, each is uint32
+ * length and bytes without a terminating zero. Interned
+ * strings and message templates are resolved, so the frame doesn't depend
+ * on the layout of the buffer. New fields would get a new version.
+ */
+static void
+append_binary_item(StringInfo out, CollectedItem *item)
+{
+	const char *data = item->data;
+	int			start = out->len;
+	uint32		len;
+
+#define BINARY_TEXT(len) \
+do { \
+	append_binary_text(out, data, (len)); \
+	data += (len); \
+} while (0)
+
+	append_uint32(out, 0);		/* set below */
+	appendStringInfoChar(out, EXPORT_BINARY_VERSION);
+	append_binary_time(out, item->logtime);
+	append_binary_time(out, item->session_start_time);
+	append_uint32(out, item->elevel);
+	append_uint32(out, item->ppid);
+	append_uint64(out, item->log_line_number);
+	append_uint32(out, item->database_id);
+	append_uint32(out, item->user_id);
+	append_uint32(out, item->saved_errno);
+	append_uint32(out, item->txid);
+	append_uint32(out, item->query_pos);
+	append_uint32(out, item->internalpos);
+	append_uint32(out, item->filename_id ? item->lineno : 0);
+	append_uint32(out, item->repeat_count);
+	append_binary_time(out, item->repeat_count > 0 ? item->last_logtime : 0);
+
+	/* ordering is important, look pg_logging.c !! */
+	if (item->flags & ITEM_MESSAGE_IS_TEMPLATE)
+		append_binary_string(out, get_interned_string(item->template_id));
+	else
+		BINARY_TEXT(item->message_len);
+	BINARY_TEXT(item->detail_len);
+	BINARY_TEXT(item->detail_log_len);
+	BINARY_TEXT(item->hint_len);
+	BINARY_TEXT(item->context_len);
+	BINARY_TEXT(item->domain_len);
+	BINARY_TEXT(item->context_domain_len);
+	BINARY_TEXT(item->internalquery_len);
+	BINARY_TEXT(item->errstate_len);
+	BINARY_TEXT(item->appname_len);
+	BINARY_TEXT(item->remote_host_len);
+	BINARY_TEXT(item->command_tag_len);
+	BINARY_TEXT(item->vxid_len);
+	BINARY_TEXT(item->query_len);
+	BINARY_TEXT(item->schema_name_len);
+	BINARY_TEXT(item->table_name_len);
+	BINARY_TEXT(item->column_name_len);
+	BINARY_TEXT(item->datatype_name_len);
+	BINARY_TEXT(item->constraint_name_len);
+	append_binary_string(out, get_interned_string(item->filename_id));
+	append_binary_string(out, get_interned_string(item->funcname_id));
+	append_binary_string(out, get_interned_string(item->template_id));
+
+	len = htonl(out->len - start - sizeof(uint32));
+	memcpy(out->data + start, &len, sizeof(len));
+#undef BINARY_TEXT
+}
+
+/* Makes frames from copied items, JSON frames are lines */
+static void
+format_items(StringInfo raw, StringInfo out)
+{
+	char   *p = raw->data;
+
+	while (p < raw->data + raw->len)
+	{
+		CollectedItem  *item = (CollectedItem *) p;
+
+		if (export_format_setting == EXPORT_FORMAT_BINARY)
+			append_binary_item(out, item);
+		else
+			append_json_item(out, item);
+
+		p += item->totallen;
+	}
+}
+
+/*
+ * Sends the batch, `out->cursor` is used as the number of bytes sent.
+ * Returns true if the whole batch was sent.
+ */
+static bool
+send_batch(StringInfo out)
+{
+	if (export_fd < 0 && !exporter_connect())
+		return false;
+
+	while (out->cursor < out->len)
+	{
+		ssize_t		n = write(export_fd, out->data + out->cursor,
+							  out->len - out->cursor);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				exporter_disconnect(out);
+
+			return false;
+		}
+		out->cursor += n;
+	}
+
+	resetStringInfo(out);
+	return true;
+}
+
+void
+pg_logging_exporter_main(Datum main_arg)
+{
+	StringInfoData	raw,
+					out;
+	int				pending = 0;	/* number of items in `out` */
+	TimestampTz		last_send = GetCurrentTimestamp();
+
+	pqsignal(SIGTERM, exporter_sigterm);
+	pqsignal(SIGHUP, exporter_sighup);
+	pqsignal(SIGPIPE, SIG_IGN);
+	BackgroundWorkerUnblockSignals();
+
+	initStringInfo(&raw);
+	initStringInfo(&out);
+
+	while (!got_sigterm)
+	{
+		int		batch_size = export_batch_size_setting * 1024;
+		int		nitems;
+		bool	blocked = false;
+		int		rc;
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		resetStringInfo(&raw);
+		nitems = fetch_items(&raw, batch_size * EXPORT_MAX_PENDING - out.len);
+		if (nitems > 0)
+		{
+			format_items(&raw, &out);
+			pending += nitems;
+		}
+
+		/* batch by size and time */
+		if (out.len > 0 && (out.len >= batch_size ||
+				TimestampDifferenceExceeds(last_send, GetCurrentTimestamp(),
+										   export_interval_setting)))
+		{
+			if (send_batch(&out))
+			{
+				pg_atomic_fetch_add_u64(&hdr->export_sent, pending);
+				pending = 0;
+				last_send = GetCurrentTimestamp();
+			}
+			else
+				blocked = true;
+		}
+
+		if (blocked && out.len >= batch_size * EXPORT_MAX_PENDING &&
+				export_overflow_setting == EXPORT_OVERFLOW_DROP)
+		{
+			/* the collector doesn't keep up, a partly sent frame breaks the stream */
+			if (out.cursor > 0)
+				exporter_disconnect(&out);
+
+			pg_atomic_fetch_add_u64(&hdr->export_dropped, pending);
+			resetStringInfo(&out);
+			pending = 0;
+		}
+
+		/* continue right away while there are logs and they could be sent */
+		if (nitems > 0 && !blocked)
+			continue;
+
+#if PG_VERSION_NUM >= 100000
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   export_interval_setting, PG_WAIT_EXTENSION);
+#else
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   export_interval_setting);
+#endif
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+
+	if (export_fd >= 0)
+	{
+		send_batch(&out);
+		close(export_fd);
+	}
+
+	proc_exit(0);
+}
@@ -0,0 +1,477 @@
+/*
+ * loader.c
+ *      Background worker loading logs into a table partitioned by days.
+ *
+ * Copyright (c) 2018, Postgres Professional
+ */
+#include "postgres.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "utils/builtins.h"
+#include "utils/datetime.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+#if PG_VERSION_NUM >= 110000
+#include "catalog/pg_type_d.h"
+#else
+#include "catalog/pg_type.h"
+#endif
+
+#include "pg_logging.h"
+
+PGDLLEXPORT void pg_logging_loader_main(Datum main_arg);
+
+typedef struct {
+	uint32		offset;			/* of the copied item */
+	int32		position;		/* in the buffer */
+	HeapTuple	tuple;
+	int			day;			/* days since 2000-01-01 UTC */
+} loaded_item;
+
+static volatile sig_atomic_t got_sigterm = false;
+static volatile sig_atomic_t got_sighup = false;
+
+static Oid	schema_oid = InvalidOid;
+static int	retention_day = -1;	/* day the retention was applied */
+static uint64 *loaded_until = NULL;	/* next items of rings after a batch */
+
+static void
+loader_sigterm(SIGNAL_ARGS)
+{
+	int		save_errno = errno;
+
+	got_sigterm = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+static void
+loader_sighup(SIGNAL_ARGS)
+{
+	int		save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+void
+register_loader(void)
+{
+	BackgroundWorker	worker;
+
+	MemSet(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 60;
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_logging loader");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pg_logging loader");
+#endif
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_logging");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "pg_logging_loader_main");
+	worker.bgw_notify_pid = 0;
+
+	RegisterBackgroundWorker(&worker);
+}
+
+static Oid
+find_extension_schema(void)
+{
+	bool	isnull;
+
+	if (SPI_execute("select extnamespace from pg_catalog.pg_extension "
+					"where extname = 'pg_logging'", true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "could not find pg_logging extension");
+
+	if (SPI_processed == 0)
+		ereport(ERROR,
+				(errmsg("pg_logging extension is not installed in database \"%s\"",
+						load_database_setting)));
+
+	return DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+										  SPI_tuptable->tupdesc, 1, &isnull));
+}
+
+static void
+partition_name(int day, char *name)
+{
+	int		year,
+			month,
+			mday;
+
+	j2date(day + POSTGRES_EPOCH_JDATE, &year, &month, &mday);
+	snprintf(name, NAMEDATALEN, "%s_%04d%02d%02d", load_table_setting,
+			 year, month, mday);
+}
+
+static char *
+day_start(int day)
+{
+	int		year,
+			month,
+			mday;
+
+	j2date(day + POSTGRES_EPOCH_JDATE, &year, &month, &mday);
+	return psprintf("%04d-%02d-%02d 00:00:00+00", year, month, mday);
+}
+
+static void
+execute_ddl(const char *sql)
+{
+	if (SPI_execute(sql, false, 0) != SPI_OK_UTILITY)
+		elog(ERROR, "pg_logging loader could not execute: %s", sql);
+}
+
+/* Opens the parent table, creates it with columns of log_item if needed */
+static Relation
+open_parent(void)
+{
+	Oid		relid = get_relname_relid(load_table_setting, schema_oid);
+
+	if (!OidIsValid(relid))
+	{
+		const char *schema = quote_identifier(get_namespace_name(schema_oid));
+
+#if PG_VERSION_NUM >= 100000
+		execute_ddl(psprintf("create table %s.%s (like %s.log_item) "
+							 "partition by range (log_time)", schema,
+							 quote_identifier(load_table_setting), schema));
+#else
+		execute_ddl(psprintf("create table %s.%s (like %s.log_item)", schema,
+							 quote_identifier(load_table_setting), schema));
+#endif
+		relid = get_relname_relid(load_table_setting, schema_oid);
+	}
+
+	return heap_open(relid, AccessShareLock);
+}
+
+/*
+ * Opens the partition for the day, creates it if needed. Before 10 there is
+ * no declarative partitioning, so children inherit the parent and have a
+ * check constraint instead.
+ */
+static Relation
+open_partition(int day)
+{
+	char	name[NAMEDATALEN];
+	Oid		relid;
+
+	partition_name(day, name);
+	relid = get_relname_relid(name, schema_oid);
+	if (!OidIsValid(relid))
+	{
+		const char *schema = quote_identifier(get_namespace_name(schema_oid));
+		const char *parent = quote_identifier(load_table_setting);
+
+#if PG_VERSION_NUM >= 100000
+		execute_ddl(psprintf("create table %s.%s partition of %s.%s "
+							 "for values from ('%s') to ('%s')",
+							 schema, quote_identifier(name), schema, parent,
+							 day_start(day), day_start(day + 1)));
+#else
+		execute_ddl(psprintf("create table %s.%s (check (log_time >= '%s' and "
+							 "log_time < '%s')) inherits (%s.%s)",
+							 schema, quote_identifier(name),
+							 day_start(day), day_start(day + 1), schema, parent));
+#endif
+		relid = get_relname_relid(name, schema_oid);
+	}
+
+	return heap_open(relid, RowExclusiveLock);
+}
+
+/* Drops partitions older than the retention period */
+static void
+drop_old_partitions(Relation parent, int today)
+{
+	char		cutoff[NAMEDATALEN];
+	const char *schema = quote_identifier(get_namespace_name(schema_oid));
+	Oid			argtypes[1] = {OIDOID};
+	Datum		args[1] = {ObjectIdGetDatum(RelationGetRelid(parent))};
+	List	   *old = NIL;
+	ListCell   *lc;
+	uint64		i;
+
+	partition_name(today - load_retention_setting, cutoff);
+	if (SPI_execute_with_args("select c.relname::text from pg_catalog.pg_inherits i "
+							  "join pg_catalog.pg_class c on c.oid = i.inhrelid "
+							  "where i.inhparent = $1",
+							  1, argtypes, args, NULL, true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "pg_logging loader could not get partitions");
+
+	/* names have the same length, so they are ordered by days */
+	for (i = 0; i < SPI_processed; i++)
+	{
+		char   *name = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+
+		if (strlen(name) == strlen(cutoff) &&
+				strncmp(name, load_table_setting, strlen(load_table_setting)) == 0 &&
+				strcmp(name, cutoff) < 0)
+			old = lappend(old, name);
+	}
+
+	foreach(lc, old)
+	{
+		execute_ddl(psprintf("drop table %s.%s", schema,
+							 quote_identifier((char *) lfirst(lc))));
+		elog(LOG, "pg_logging loader dropped partition \"%s\"",
+			 (char *) lfirst(lc));
+	}
+}
+
+/*
+ * Copies items which were not loaded yet. Rings are locked one by one in
+ * shared mode only while their items are copied, tuples are made later.
+ * `until` gets the next item to load for each ring, load_seq is moved
+ * only after the batch is committed.
+ */
+static int
+fetch_items(StringInfo raw, loaded_item *items, int limit, uint64 *until)
+{
+	int		n = 0;
+	int		i;
+
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		LogRing	   *ring = &hdr->rings[i];
+		char	   *ringdata = RING_DATA(ring);
+		uint64		seq;
+
+		RING_LOCK_SHARED(ring);
+		seq = Max(ring->load_seq, ring->first_seq);
+		for (; seq < ring->next_seq && n < limit; seq++)
+		{
+			ItemSummary	   *summary = RING_SUMMARY(ring, seq);
+			int				part1;
+
+			if (summary->written != (uint32) seq)
+				break;
+
+			pg_read_barrier();
+			items[n].offset = raw->len;
+			items[n].position = ring->offset + summary->pos;
+			items[n].day = (int) (summary->logtime / USECS_PER_DAY);
+			part1 = Min(summary->totallen, ring->buffer_size - summary->pos);
+			appendBinaryStringInfo(raw, ringdata + summary->pos, part1);
+			appendBinaryStringInfo(raw, ringdata, summary->totallen - part1);
+			n++;
+		}
+		until[i] = seq;
+		RING_RELEASE(ring);
+	}
+
+	return n;
+}
+
+static void
+form_tuples(TupleDesc tupdesc, StringInfo raw, loaded_item *items, int nitems)
+{
+	Datum	values[Natts_pg_logging_data];
+	bool	isnull[Natts_pg_logging_data];
+	int		i;
+
+	for (i = 0; i < nitems; i++)
+	{
+		fill_values_from(raw->data, raw->len, items[i].offset, values, isnull);
+		values[Anum_pg_logging_position - 1] = Int32GetDatum(items[i].position);
+		isnull[Anum_pg_logging_position - 1] = false;
+		items[i].tuple = heap_form_tuple(tupdesc, values, isnull);
+	}
+}
+
+static int
+loaded_item_cmp(const void *a, const void *b)
+{
+	return ((const loaded_item *) a)->day - ((const loaded_item *) b)->day;
+}
+
+/* heap_multi_insert doesn't touch indexes, so they are updated here */
+static void
+insert_index_tuples(Relation rel, HeapTuple *tuples, int ntuples)
+{
+	EState		   *estate = CreateExecutorState();
+	ResultRelInfo  *rri = makeNode(ResultRelInfo);
+	TupleTableSlot *slot = MakeSingleTupleTableSlot(RelationGetDescr(rel));
+	int				i;
+
+#if PG_VERSION_NUM >= 100000
+	InitResultRelInfo(rri, rel, 1, NULL, 0);
+#else
+	InitResultRelInfo(rri, rel, 1, 0);
+#endif
+	estate->es_result_relations = rri;
+	estate->es_num_result_relations = 1;
+	estate->es_result_relation_info = rri;
+	ExecOpenIndices(rri, false);
+
+	for (i = 0; i < ntuples; i++)
+	{
+		ResetPerTupleExprContext(estate);
+		ExecStoreTuple(tuples[i], slot, InvalidBuffer, false);
+		list_free(ExecInsertIndexTuples(slot, &tuples[i]->t_self, estate,
+										false, NULL, NIL));
+	}
+
+	ExecCloseIndices(rri);
+	ExecDropSingleTupleTableSlot(slot);
+	FreeExecutorState(estate);
+}
+
+static void
+insert_tuples(int day, HeapTuple *tuples, int ntuples)
+{
+	Relation		rel = open_partition(day);
+	BulkInsertState	bistate = GetBulkInsertState();
+
+	heap_multi_insert(rel, tuples, ntuples, GetCurrentCommandId(true), 0, bistate);
+	FreeBulkInsertState(bistate);
+
+	if (RelationGetForm(rel)->relhasindex)
+		insert_index_tuples(rel, tuples, ntuples);
+
+	heap_close(rel, NoLock);
+}
+
+/*
+ * Loads one batch in its own transaction, returns number of loaded logs.
+ * Logs are marked as loaded only after the transaction is committed, so
+ * logs of a failed batch are loaded again by the restarted worker (unless
+ * they are evicted meanwhile).
+ */
+static int
+load_batch(void)
+{
+	Relation	parent;
+	StringInfoData raw;
+	loaded_item *items;
+	HeapTuple  *tuples;
+	uint64	   *until;
+	int			nitems;
+	int			today = (int) (GetCurrentTimestamp() / USECS_PER_DAY);
+	int			i,
+				start;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "pg_logging: loading logs");
+
+	if (!OidIsValid(schema_oid))
+		schema_oid = find_extension_schema();
+
+	parent = open_parent();
+	if (RelationGetDescr(parent)->natts != Natts_pg_logging_data)
+		elog(ERROR, "columns of \"%s\" don't match log_item", load_table_setting);
+
+	initStringInfo(&raw);
+	items = palloc(sizeof(loaded_item) * load_batch_size_setting);
+	tuples = palloc(sizeof(HeapTuple) * load_batch_size_setting);
+	until = palloc(sizeof(uint64) * hdr->nrings);
+	nitems = fetch_items(&raw, items, load_batch_size_setting, until);
+	form_tuples(RelationGetDescr(parent), &raw, items, nitems);
+
+	/* one multi-insert for each day */
+	qsort(items, nitems, sizeof(loaded_item), loaded_item_cmp);
+	for (start = 0; start < nitems; start = i)
+	{
+		for (i = start; i < nitems && items[i].day == items[start].day; i++)
+			tuples[i - start] = items[i].tuple;
+
+		insert_tuples(items[start].day, tuples, i - start);
+	}
+
+	if (load_retention_setting > 0 && retention_day != today)
+	{
+		drop_old_partitions(parent, today);
+		retention_day = today;
+	}
+
+	heap_close(parent, NoLock);
+	SPI_finish();
+	PopActiveSnapshot();
+
+	/* memory of the transaction is freed on commit */
+	memcpy(loaded_until, until, sizeof(uint64) * hdr->nrings);
+	CommitTransactionCommand();
+
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		LogRing	   *ring = &hdr->rings[i];
+
+		/* the buffer could be reset by resizing meanwhile */
+		RING_LOCK(ring);
+		ring->load_seq = Max(ring->load_seq,
+							 Min(loaded_until[i], ring->next_seq));
+		RING_RELEASE(ring);
+	}
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return nitems;
+}
+
+void
+pg_logging_loader_main(Datum main_arg)
+{
+	pqsignal(SIGTERM, loader_sigterm);
+	pqsignal(SIGHUP, loader_sighup);
+	BackgroundWorkerUnblockSignals();
+
+	loaded_until = MemoryContextAlloc(TopMemoryContext, sizeof(uint64) * hdr->nrings);
+
+	/* partitions are named after the table */
+	if (strlen(load_table_setting) > NAMEDATALEN - 10)
+		elog(ERROR, "pg_logging.load_table is too long");
+
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnection(load_database_setting, NULL, 0);
+#else
+	BackgroundWorkerInitializeConnection(load_database_setting, NULL);
+#endif
+
+	while (!got_sigterm)
+	{
+		int		rc;
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		/* a full batch means that more logs are waiting */
+		if (load_batch() >= load_batch_size_setting)
+			continue;
+
+#if PG_VERSION_NUM >= 100000
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   load_interval_setting, PG_WAIT_EXTENSION);
+#else
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   load_interval_setting);
+#endif
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+
+	proc_exit(0);
+}
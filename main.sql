@@ -47,7 +47,19 @@ create type log_item as (
 	txid				bigint,						/* transaction id */
 	query				text,
 	query_pos			int,
-	position			int							/* position in logs buffer */
+	position			int,						/* position in logs buffer */
+	object_type			text,						/* table, column, datatype or constraint */
+	schema_name			text,
+	table_name			text,
+	column_name			text,
+	datatype_name		text,
+	constraint_name		text,
+	filename			text,						/* error location */
+	lineno				int,
+	funcname			text,
+	message_template	text,						/* untranslated message format */
+	repeat_count		int,						/* times repeated right after */
+	last_log_time		timestamp with time zone	/* time of the last repeat */
 );
 
 create or replace function get_log(
@@ -62,6 +74,49 @@ create or replace function get_log(
 returns log_item as 'MODULE_PATHNAME', 'get_logged_data_from'
 language c;
 
+create or replace function get_tenant_log(
+	tenant			oid
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_tenant'
+language c parallel safe;
+
+create or replace function get_log_grep(
+	pattern			text
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_grep'
+language c strict parallel safe;
+
+create or replace function get_log_tail(
+	n				int,
+	level			error_level default null,
+	datid			oid default null,
+	userid			oid default null,
+	errcode			text default null
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_tail'
+language c parallel safe;
+
+create or replace function get_log_for_pid(
+	pid				int
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_pid'
+language c strict parallel safe;
+
+create or replace function get_log_for_xact(
+	txid			bigint
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_xact'
+language c strict parallel safe;
+
+create or replace function count_log(
+	level			error_level default null,
+	datid			oid default null,
+	userid			oid default null,
+	errcode			text default null
+)
+returns bigint as 'MODULE_PATHNAME', 'count_logged_data'
+language c parallel safe;
+
 create or replace function flush_log()
 returns void as 'MODULE_PATHNAME', 'flush_logged_data'
 language c;
@@ -74,3 +129,112 @@ create or replace function test_ereport(
 )
 returns void as 'MODULE_PATHNAME', 'test_ereport'
 language c;
+
+create or replace function bench_log_hook(
+	loops		int,
+	elevel		error_level default 'log'
+)
+returns float8 as 'MODULE_PATHNAME', 'bench_log_hook'
+language c strict;
+
+/* make sure this type is correlated with enum in pg_logging.h */
+create type filter_item as (
+	num					int,
+	action				text,						/* include or exclude */
+	datid				oid,
+	userid				oid,
+	errcode				text,						/* SQLSTATE code or class */
+	message				text						/* regular expression */
+);
+
+create or replace function add_filter(
+	action			text,
+	datid			oid default null,
+	userid			oid default null,
+	errcode			text default null,
+	message			text default null
+)
+returns int as 'MODULE_PATHNAME', 'add_filter'
+language c;
+
+create or replace function clear_filters()
+returns void as 'MODULE_PATHNAME', 'clear_filters'
+language c;
+
+create or replace function get_filters()
+returns setof filter_item as 'MODULE_PATHNAME', 'get_filters'
+language c;
+
+/* make sure this type is correlated with enum in pg_logging.h */
+create type rollup_item as (
+	bucket_start		timestamp with time zone,	/* start of the interval */
+	datid				oid,
+	level				int,
+	errclass			text,						/* SQLSTATE class */
+	count				bigint
+);
+
+create or replace function get_log_rollup(
+	since			timestamp with time zone default null
+)
+returns setof rollup_item as 'MODULE_PATHNAME', 'get_rollup'
+language c parallel safe;
+
+create or replace function get_export_stats(
+	out sent		bigint,
+	out dropped		bigint
+)
+as 'MODULE_PATHNAME', 'get_export_stats'
+language c;
+
+create or replace function get_my_log(
+	flush			bool default true
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_session_logged_data'
+language c;
+
+create or replace function get_log_partial(
+	part			int,
+	nparts			int
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_partial'
+language c strict parallel safe;
+
+create or replace function get_shedding_stats(
+	out ring		int,
+	out horizon		interval,
+	out ingest_rate	float8,
+	out shed_level	error_level,
+	out raised		bigint,
+	out relaxed		bigint,
+	out shed		bigint
+)
+returns setof record as 'MODULE_PATHNAME', 'get_shedding_stats'
+language c;
+
+create or replace function create_log_snapshot(
+	name			text
+)
+returns int as 'MODULE_PATHNAME', 'create_log_snapshot'
+language c strict;
+
+create or replace function get_log_snapshot(
+	name			text
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_log_snapshot'
+language c strict parallel safe;
+
+create or replace function drop_log_snapshot(
+	name			text
+)
+returns void as 'MODULE_PATHNAME', 'drop_log_snapshot'
+language c strict;
+
+create or replace function get_log_snapshots(
+	out name		text,
+	out created		timestamp with time zone,
+	out logs		int,
+	out size		bigint
+)
+returns setof record as 'MODULE_PATHNAME', 'get_log_snapshots'
+language c;
@@ -0,0 +1,319 @@
+/*
+ * persist.c
+ *      Saving the ring buffer to a file on shutdown and loading it back at
+ *      startup.
+ *
+ * Copyright (c) 2018, Postgres Professional
+ */
+#include "postgres.h"
+
+#include <unistd.h>
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/fd.h"
+
+#include "pg_logging.h"
+
+#define DUMP_FILE		PGSTAT_STAT_PERMANENT_DIRECTORY "/pg_logging.dump"
+#define DUMP_FILE_TMP	DUMP_FILE ".tmp"
+#define DUMP_MAGIC		0x4C4F4744
+#define DUMP_VERSION	1
+
+/*
+ * The file is the header followed by rings, buffer data, chunks, summaries
+ * and interned strings, as they are in shared memory. It could be loaded
+ * only to the buffer with the same layout.
+ */
+typedef struct DumpHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		pg_version;
+	uint32		ring_size;			/* sizes of structures */
+	uint32		summary_size;
+	uint32		item_hdr_len;
+	int			buffer_size;
+	int			buffer_size_initial;
+	int			nrings;
+	int			npartitions;
+	int			ntiers;
+	int			tier_split[MAX_TIERS];
+	int			partition_by;
+	uint32		intern_arena_used;
+	bool		crashed;			/* written after a crash */
+} DumpHeader;
+
+static void
+fill_dump_header(DumpHeader *dh)
+{
+	MemSet(dh, 0, sizeof(DumpHeader));
+	dh->magic = DUMP_MAGIC;
+	dh->version = DUMP_VERSION;
+	dh->pg_version = PG_VERSION_NUM;
+	dh->ring_size = sizeof(LogRing);
+	dh->summary_size = sizeof(ItemSummaryPadded);
+	dh->item_hdr_len = ITEM_HDR_LEN;
+	dh->buffer_size = hdr->buffer_size;
+	dh->buffer_size_initial = hdr->buffer_size_initial;
+	dh->nrings = hdr->nrings;
+	dh->npartitions = hdr->npartitions;
+	dh->ntiers = hdr->ntiers;
+	memcpy(dh->tier_split, hdr->tier_split, sizeof(dh->tier_split));
+	dh->partition_by = hdr->partition_by;
+	dh->intern_arena_used = hdr->intern_arena_used;
+}
+
+static bool
+dump_layout_matches(DumpHeader *dh, DumpHeader *expected)
+{
+	return dh->magic == expected->magic &&
+		dh->version == expected->version &&
+		dh->pg_version == expected->pg_version &&
+		dh->ring_size == expected->ring_size &&
+		dh->summary_size == expected->summary_size &&
+		dh->item_hdr_len == expected->item_hdr_len &&
+		dh->buffer_size == expected->buffer_size &&
+		dh->buffer_size_initial == expected->buffer_size_initial &&
+		dh->nrings == expected->nrings &&
+		dh->npartitions == expected->npartitions &&
+		dh->ntiers == expected->ntiers &&
+		memcmp(dh->tier_split, expected->tier_split, sizeof(dh->tier_split)) == 0 &&
+		dh->partition_by == expected->partition_by &&
+		dh->intern_arena_used <= INTERN_ARENA_SIZE;
+}
+
+/*
+ * Layout of the buffer and its addresses in shared memory, as they were set
+ * up at startup. The header in shared memory could be overwritten before a
+ * crash, so it's checked against them before the buffer is dumped.
+ */
+static DumpHeader	startup_layout;
+static struct {
+	LogRing			   *rings;
+	char			   *data;
+	LogChunk		   *chunks;
+	ItemSummaryPadded  *summaries;
+} startup_addrs;
+
+/*
+ * Remembers the layout of the buffer, should be called in postmaster once
+ * the buffer is set up.
+ */
+void
+save_dump_layout(void)
+{
+	fill_dump_header(&startup_layout);
+	startup_addrs.rings = hdr->rings;
+	startup_addrs.data = hdr->data;
+	startup_addrs.chunks = hdr->chunks;
+	startup_addrs.summaries = hdr->summaries;
+}
+
+/*
+ * Checks the header in shared memory against the layout saved at startup.
+ * The buffer size could be only decreased since then.
+ */
+static bool
+dump_header_valid(DumpHeader *dh)
+{
+	DumpHeader *sl = &startup_layout;
+
+	return dh->buffer_size_initial == sl->buffer_size_initial &&
+		dh->buffer_size > 0 &&
+		dh->buffer_size <= dh->buffer_size_initial &&
+		dh->nrings == sl->nrings &&
+		dh->npartitions == sl->npartitions &&
+		dh->ntiers == sl->ntiers &&
+		memcmp(dh->tier_split, sl->tier_split, sizeof(dh->tier_split)) == 0 &&
+		dh->partition_by == sl->partition_by &&
+		dh->intern_arena_used <= INTERN_ARENA_SIZE &&
+		hdr->rings == startup_addrs.rings &&
+		hdr->data == startup_addrs.data &&
+		hdr->chunks == startup_addrs.chunks &&
+		hdr->summaries == startup_addrs.summaries;
+}
+
+/*
+ * After a crash some items could be reserved but not written, forget them
+ * and all items after them.
+ */
+static void
+drop_incomplete_items(LogRing *ring)
+{
+	LogChunk   *chunks = RING_CHUNKS(ring);
+	uint64		seq;
+	int			c;
+
+	for (seq = ring->first_seq; seq < ring->next_seq; seq++)
+		if (RING_SUMMARY(ring, seq)->written != (uint32) seq)
+			break;
+
+	if (seq == ring->next_seq)
+		return;
+
+	if (seq == ring->first_seq)
+		ring->endpos = ring->firstpos;
+	else
+	{
+		ItemSummary *last = RING_SUMMARY(ring, seq - 1);
+
+		ring->endpos = (last->pos + last->totallen) % ring->buffer_size;
+	}
+	ring->next_seq = seq;
+
+	for (c = 0; c < ring->nchunks; c++)
+		if (chunks[c].first != INVALID_ITEM_POS && chunks[c].seq >= seq)
+			chunks[c].first = INVALID_ITEM_POS;
+
+	if (ring->read_seq > seq)
+	{
+		ring->readpos = ring->endpos;
+		ring->read_seq = seq;
+	}
+	ring->wraparound = ring->readpos > ring->endpos;
+	ring->export_seq = Min(ring->export_seq, seq);
+	ring->load_seq = Min(ring->load_seq, seq);
+}
+
+/*
+ * on_shmem_exit callback of postmaster, it's called on shutdown and also
+ * before shared memory is reinitialized after a crash.
+ */
+void
+dump_rings(int code, Datum arg)
+{
+	DumpHeader	dh;
+	FILE	   *file;
+
+	if (!persist_setting || hdr == NULL)
+		return;
+
+	fill_dump_header(&dh);
+	if (!dump_header_valid(&dh))
+	{
+		ereport(LOG,
+				(errmsg("pg_logging buffer is not saved because its header in shared memory is corrupted")));
+		return;
+	}
+	dh.crashed = (code != 0);
+
+	file = AllocateFile(DUMP_FILE_TMP, PG_BINARY_W);
+	if (file == NULL)
+		goto error;
+
+	if (fwrite(&dh, sizeof(dh), 1, file) != 1 ||
+		fwrite(hdr->rings, sizeof(LogRing), hdr->nrings, file) != hdr->nrings ||
+		fwrite(hdr->data, 1, hdr->buffer_size_initial, file) != hdr->buffer_size_initial ||
+		fwrite(hdr->chunks, sizeof(LogChunk),
+			   MAX_CHUNKS(hdr->buffer_size_initial, hdr->nrings), file) !=
+				MAX_CHUNKS(hdr->buffer_size_initial, hdr->nrings) ||
+		fwrite(hdr->summaries, sizeof(ItemSummaryPadded),
+			   MAX_SUMMARIES(hdr->buffer_size_initial, hdr->nrings), file) !=
+				MAX_SUMMARIES(hdr->buffer_size_initial, hdr->nrings) ||
+		fwrite(hdr->interned, sizeof(hdr->interned), 1, file) != 1 ||
+		fwrite(hdr->intern_arena, 1, hdr->intern_arena_used, file) != hdr->intern_arena_used)
+		goto error;
+
+	if (FreeFile(file))
+	{
+		file = NULL;
+		goto error;
+	}
+
+	(void) durable_rename(DUMP_FILE_TMP, DUMP_FILE, LOG);
+	return;
+
+error:
+	ereport(LOG,
+			(errcode_for_file_access(),
+			 errmsg("could not write file \"%s\": %m", DUMP_FILE_TMP)));
+	if (file)
+		FreeFile(file);
+	unlink(DUMP_FILE_TMP);
+}
+
+/*
+ * Loads the buffer saved by dump_rings, should be called right after the
+ * buffer is set up in postmaster. The file is removed, so the same logs
+ * are not loaded twice.
+ */
+void
+load_rings(void)
+{
+	DumpHeader	dh,
+				expected;
+	FILE	   *file;
+	LogRing	   *rings;
+	int			i;
+
+	file = AllocateFile(DUMP_FILE, PG_BINARY_R);
+	if (file == NULL)
+	{
+		if (errno != ENOENT)
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m", DUMP_FILE)));
+		return;
+	}
+
+	fill_dump_header(&expected);
+	if (fread(&dh, sizeof(dh), 1, file) != 1)
+		goto read_error;
+
+	if (!dump_layout_matches(&dh, &expected))
+	{
+		ereport(LOG,
+				(errmsg("ignoring file \"%s\" saved with different layout of the buffer",
+						DUMP_FILE)));
+		goto done;
+	}
+
+	rings = palloc(sizeof(LogRing) * hdr->nrings);
+	if (fread(rings, sizeof(LogRing), hdr->nrings, file) != hdr->nrings ||
+		fread(hdr->data, 1, hdr->buffer_size_initial, file) != hdr->buffer_size_initial ||
+		fread(hdr->chunks, sizeof(LogChunk),
+			  MAX_CHUNKS(hdr->buffer_size_initial, hdr->nrings), file) !=
+				MAX_CHUNKS(hdr->buffer_size_initial, hdr->nrings) ||
+		fread(hdr->summaries, sizeof(ItemSummaryPadded),
+			  MAX_SUMMARIES(hdr->buffer_size_initial, hdr->nrings), file) !=
+				MAX_SUMMARIES(hdr->buffer_size_initial, hdr->nrings) ||
+		fread(hdr->interned, sizeof(hdr->interned), 1, file) != 1 ||
+		fread(hdr->intern_arena, 1, dh.intern_arena_used, file) != dh.intern_arena_used)
+	{
+		pfree(rings);
+		goto read_error;
+	}
+	hdr->intern_arena_used = dh.intern_arena_used;
+
+	/* locks are already initialized, keep them */
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		LogRing		   *ring = &hdr->rings[i];
+		LWLockPadded	lock = ring->lock;
+
+		memcpy(ring, &rings[i], sizeof(LogRing));
+		ring->lock = lock;
+
+		if (dh.crashed)
+			drop_incomplete_items(ring);
+	}
+	pfree(rings);
+
+	ereport(LOG, (errmsg("pg_logging loaded logs from \"%s\"", DUMP_FILE)));
+	goto done;
+
+read_error:
+	ereport(LOG,
+			(errcode_for_file_access(),
+			 errmsg("could not read file \"%s\": %m", DUMP_FILE)));
+
+	/* the buffer could be partly overwritten */
+	setup_rings(hdr->buffer_size);
+	memset(hdr->interned, 0, sizeof(hdr->interned));
+	hdr->intern_arena_used = 0;
+
+done:
+	FreeFile(file);
+	unlink(DUMP_FILE);
+}
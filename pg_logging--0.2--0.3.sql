@@ -0,0 +1,166 @@
+alter type log_item
+	add attribute object_type		text,
+	add attribute schema_name		text,
+	add attribute table_name		text,
+	add attribute column_name		text,
+	add attribute datatype_name		text,
+	add attribute constraint_name	text,
+	add attribute filename			text,
+	add attribute lineno			int,
+	add attribute funcname			text,
+	add attribute message_template	text,
+	add attribute repeat_count		int,
+	add attribute last_log_time		timestamp with time zone;
+
+/* make sure this type is correlated with enum in pg_logging.h */
+create type filter_item as (
+	num					int,
+	action				text,						/* include or exclude */
+	datid				oid,
+	userid				oid,
+	errcode				text,						/* SQLSTATE code or class */
+	message				text						/* regular expression */
+);
+
+create function add_filter(
+	action			text,
+	datid			oid default null,
+	userid			oid default null,
+	errcode			text default null,
+	message			text default null
+)
+returns int as 'MODULE_PATHNAME', 'add_filter'
+language c;
+
+create function clear_filters()
+returns void as 'MODULE_PATHNAME', 'clear_filters'
+language c;
+
+create function get_filters()
+returns setof filter_item as 'MODULE_PATHNAME', 'get_filters'
+language c;
+
+create function get_tenant_log(
+	tenant			oid
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_tenant'
+language c parallel safe;
+
+create function get_log_grep(
+	pattern			text
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_grep'
+language c strict parallel safe;
+
+create function count_log(
+	level			error_level default null,
+	datid			oid default null,
+	userid			oid default null,
+	errcode			text default null
+)
+returns bigint as 'MODULE_PATHNAME', 'count_logged_data'
+language c parallel safe;
+
+create function get_log_tail(
+	n				int,
+	level			error_level default null,
+	datid			oid default null,
+	userid			oid default null,
+	errcode			text default null
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_tail'
+language c parallel safe;
+
+create function get_log_for_pid(
+	pid				int
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_pid'
+language c strict parallel safe;
+
+create function get_log_for_xact(
+	txid			bigint
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_xact'
+language c strict parallel safe;
+
+create function bench_log_hook(
+	loops		int,
+	elevel		error_level default 'log'
+)
+returns float8 as 'MODULE_PATHNAME', 'bench_log_hook'
+language c strict;
+
+/* make sure this type is correlated with enum in pg_logging.h */
+create type rollup_item as (
+	bucket_start		timestamp with time zone,	/* start of the interval */
+	datid				oid,
+	level				int,
+	errclass			text,						/* SQLSTATE class */
+	count				bigint
+);
+
+/* every log passing pg_logging.minlevel, even if it's shed, filtered or repeated */
+create function get_log_rollup(
+	since			timestamp with time zone default null
+)
+returns setof rollup_item as 'MODULE_PATHNAME', 'get_rollup'
+language c parallel safe;
+
+create function get_export_stats(
+	out sent		bigint,
+	out dropped		bigint
+)
+as 'MODULE_PATHNAME', 'get_export_stats'
+language c;
+
+create function get_my_log(
+	flush			bool default true
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_session_logged_data'
+language c;
+
+create function get_log_partial(
+	part			int,
+	nparts			int
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_logged_data_partial'
+language c strict parallel safe;
+
+create function get_shedding_stats(
+	out ring		int,
+	out horizon		interval,
+	out ingest_rate	float8,
+	out shed_level	error_level,
+	out raised		bigint,
+	out relaxed		bigint,
+	out shed		bigint
+)
+returns setof record as 'MODULE_PATHNAME', 'get_shedding_stats'
+language c;
+
+create function create_log_snapshot(
+	name			text
+)
+returns int as 'MODULE_PATHNAME', 'create_log_snapshot'
+language c strict;
+
+create function get_log_snapshot(
+	name			text
+)
+returns setof log_item as 'MODULE_PATHNAME', 'get_log_snapshot'
+language c strict parallel safe;
+
+create function drop_log_snapshot(
+	name			text
+)
+returns void as 'MODULE_PATHNAME', 'drop_log_snapshot'
+language c strict;
+
+create function get_log_snapshots(
+	out name		text,
+	out created		timestamp with time zone,
+	out logs		int,
+	out size		bigint
+)
+returns setof record as 'MODULE_PATHNAME', 'get_log_snapshots'
+language c;
@@ -5,19 +5,24 @@
  * Copyright (c) 2018, Postgres Professional
  */
 #include "postgres.h"
+#include "access/hash.h"
 #include "access/xact.h"
+#include "catalog/pg_collation.h"
 #include "fmgr.h"
 #include "libpq/libpq-be.h"
+#include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "postmaster/autovacuum.h"
 #include "storage/dsm.h"
 #include "storage/ipc.h"
+#include "storage/proc.h"
 #include "storage/shm_mq.h"
 #include "storage/shm_toc.h"
 #include "string.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
+#include "utils/memutils.h"
 #include "utils/ps_status.h"
 
 #include "pg_logging.h"
@@ -29,10 +34,88 @@ void		_PG_fini(void);
 
 /* global variables */
 int						buffer_size_setting = 0;
+int						partitions_setting = 1;
+int						partition_by_setting = PARTITION_NONE;
+char				   *tier_split_setting = NULL;
+int						rollup_interval_setting = 60;
+char				   *export_path_setting = NULL;
+int						export_format_setting = EXPORT_FORMAT_JSON;
+int						export_batch_size_setting = 64;
+int						export_interval_setting = 1000;
+int						export_overflow_setting = EXPORT_OVERFLOW_DROP;
+char				   *load_database_setting = NULL;
+char				   *load_table_setting = NULL;
+int						load_batch_size_setting = 1000;
+int						load_interval_setting = 10000;
+int						load_retention_setting = 0;
+int						session_buffer_size_setting = 0;
+bool					persist_setting = false;
+SessionRing				session_ring;
+static int				tier_split[MAX_TIERS];
 shm_toc				   *toc = NULL;
 LoggingShmemHdr		   *hdr = NULL;
 bool					shmem_initialized = false;
-bool					buffer_increase_suggested = false;
+
+/* backend local copy of capture filters */
+static uint32			filters_gen = 0;
+static int				nfilters = 0;
+static LogFilter		filters[MAX_FILTERS];
+static regex_t		   *filters_regex[MAX_FILTERS];
+
+/* text block of an item, the header is followed by ITEM_NBLOCKS of them */
+#define ITEM_NBLOCKS	19
+
+typedef struct ItemBlock
+{
+	const char *data;
+	int			len;
+} ItemBlock;
+
+/*
+ * Backend local cache of interned strings. Source file and function names
+ * and message formats in ErrorData are string constants, so their addresses
+ * are enough to find ids without hashing the strings.
+ */
+#define INTERN_CACHE_SIZE	256
+
+static struct {
+	const char *str;
+	int			id;
+} intern_cache[INTERN_CACHE_SIZE];
+
+/*
+ * Backend local values used by the hook which don't change on each call.
+ * Only the kind of the backend is computed once, vxid is kept until local
+ * transaction id changes, SQLSTATE text until the code does. Texts which
+ * could change at any time, like application_name, the command tag and the
+ * remote host, are read on each call.
+ */
+static struct {
+	bool				initialized;
+	bool				has_user;		/* regular backend with session user */
+	LocalTransactionId	lxid;
+	char				vxid[VXID_BUFSIZE];
+	int					vxid_len;
+	int					sqlerrcode;
+	char				sqlstate[6];
+} hook_cache;
+
+/*
+ * The last item written by this backend, repeats of it are counted in the
+ * item instead of writing new items.
+ */
+static struct {
+	int				ring;			/* -1 if there is no such item */
+	uint64			seq;
+	int				elevel;
+	int				sqlerrcode;
+	uint32			hash;			/* hash of the message */
+	TransactionId	txid;
+	bool			in_session;		/* the newest item of the session ring */
+} last_item = {-1};
+
+/* index of the chain of this backend in hdr->chains, or -1 */
+static int				my_chain = -1;
 
 static emit_log_hook_type		pg_logging_log_hook_next = NULL;
 static shmem_startup_hook_type	pg_logging_shmem_hook_next = NULL;
@@ -46,193 +129,1225 @@ LWLockPadded *lwlock_array[1] = {NULL};
 static LWLockTranche LoggingLWLockTranche = {"pg_logging", lwlock_array, sizeof(LWLockPadded)};
 #endif
 
-enum {
-	WRAP_NONE,
-	WRAP_PARTIAL,
-	WRAP_FULL,
+#define safe_strlen(s) ((s) ? strlen(s) : 0)
+
+static void
+buffer_size_assign_hook(int newval, void *extra)
+{
+	if (!shmem_initialized)
+		return;
+
+	newval = newval * 1024;
+	if (newval > hdr->buffer_size_initial)
+		elog(ERROR, "buffer size cannot be increased");
+
+	reset_counters_in_shmem(newval);
+}
+
+/* Frees the session ring when it's disabled, a new one is allocated on use */
+static void
+session_buffer_size_assign_hook(int newval, void *extra)
+{
+	SessionRing	   *sr = &session_ring;
+
+	if (newval != 0 || sr->data == NULL || sr->reading)
+		return;
+
+	pfree(sr->data);
+	MemSet(sr, 0, sizeof(SessionRing));
+}
+
+static const struct config_enum_entry level_options[] = {
+	{"none", 0, true},
+	{"debug", DEBUG2, true},
+	{"debug5", DEBUG5, false},
+	{"debug4", DEBUG4, false},
+	{"debug3", DEBUG3, false},
+	{"debug2", DEBUG2, false},
+	{"debug1", DEBUG1, false},
+	{"log", LOG, false},
+	{"info", INFO, true},
+	{"notice", NOTICE, false},
+	{"warning", WARNING, false},
+	{"error", ERROR, false},
+	{"fatal", FATAL, false},
+	{"panic", PANIC, false},
+	{NULL, 0, false}
 };
 
-#define safe_strlen(s) ((s) ? strlen(s) : 0)
+static bool
+parse_tier_split(const char *value, int *split)
+{
+	const char *p = value;
+	int			total = 0;
+	int			i;
+
+	for (i = 0; i < MAX_TIERS; i++)
+	{
+		char   *end;
+		long	val = strtol(p, &end, 10);
+
+		if (end == p || val <= 0 || val > 100)
+			return false;
+
+		split[i] = (int) val;
+		total += split[i];
+		p = end;
+
+		if (i < MAX_TIERS - 1)
+		{
+			if (*p != ',')
+				return false;
+			p++;
+		}
+	}
+
+	return *p == '\0' && total == 100;
+}
+
+static bool
+tier_split_check_hook(char **newval, void **extra, GucSource source)
+{
+	int		split[MAX_TIERS];
+
+	if (*newval == NULL || **newval == '\0')
+		return true;
+
+	if (!parse_tier_split(*newval, split))
+	{
+		GUC_check_errdetail("Should be three percents of the buffer for "
+				"debug..info, warning and error..panic levels, with sum of 100.");
+		return false;
+	}
+
+	return true;
+}
+
+static const struct config_enum_entry partition_by_options[] = {
+	{"none", PARTITION_NONE, false},
+	{"database", PARTITION_DATABASE, false},
+	{"role", PARTITION_ROLE, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry export_format_options[] = {
+	{"json", EXPORT_FORMAT_JSON, false},
+	{"binary", EXPORT_FORMAT_BINARY, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry export_overflow_options[] = {
+	{"drop", EXPORT_OVERFLOW_DROP, false},
+	{"pause", EXPORT_OVERFLOW_PAUSE, false},
+	{NULL, 0, false}
+};
+
+static void
+setup_gucs(bool basic)
+{
+	if (basic)
+	{
+		DefineCustomIntVariable(
+			"pg_logging.buffer_size",
+			"Sets size of the ring buffer used to keep logs", NULL,
+			&buffer_size_setting,
+			1024 * 10, /* 10MB */
+			1024,
+			INT_MAX,
+			PGC_SUSET,
+			GUC_UNIT_KB,
+			NULL, buffer_size_assign_hook, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.partitions",
+			"Sets number of ring buffer partitions", NULL,
+			&partitions_setting,
+			1,
+			1,
+			MAX_PARTITIONS,
+			PGC_POSTMASTER,
+			0,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomEnumVariable(
+			"pg_logging.partition_by",
+			"Sets what is used to choose a partition for logs",
+			NULL,
+			&partition_by_setting,
+			PARTITION_NONE,
+			partition_by_options,
+			PGC_POSTMASTER,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomStringVariable(
+			"pg_logging.tier_split",
+			"Splits the buffer between levels, like '20,30,50'",
+			"Percents of the buffer for debug..info, warning and "
+			"error..panic levels. Each part wraps independently.",
+			&tier_split_setting,
+			"",
+			PGC_POSTMASTER,
+			0,
+			tier_split_check_hook, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.rollup_interval",
+			"Sets length of intervals for counters of logs", NULL,
+			&rollup_interval_setting,
+			60,
+			1,
+			SECS_PER_DAY,
+			PGC_POSTMASTER,
+			GUC_UNIT_S,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomStringVariable(
+			"pg_logging.export_path",
+			"Sets Unix socket or FIFO the logs are exported to",
+			"Export is disabled if empty.",
+			&export_path_setting,
+			"",
+			PGC_POSTMASTER,
+			0,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomEnumVariable(
+			"pg_logging.export_format",
+			"Sets format of exported logs", NULL,
+			&export_format_setting,
+			EXPORT_FORMAT_JSON,
+			export_format_options,
+			PGC_SIGHUP,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.export_batch_size",
+			"Sets size of batches sent by the exporter", NULL,
+			&export_batch_size_setting,
+			64,
+			1,
+			INT_MAX / 1024 / 4,
+			PGC_SIGHUP,
+			GUC_UNIT_KB,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.export_interval",
+			"Sets maximum time the exporter waits to fill a batch", NULL,
+			&export_interval_setting,
+			1000,
+			1,
+			INT_MAX,
+			PGC_SIGHUP,
+			GUC_UNIT_MS,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomEnumVariable(
+			"pg_logging.export_overflow",
+			"Sets what the exporter does when the collector doesn't keep up",
+			"drop skips pending batches, pause leaves logs in the buffer.",
+			&export_overflow_setting,
+			EXPORT_OVERFLOW_DROP,
+			export_overflow_options,
+			PGC_SIGHUP,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomBoolVariable(
+			"pg_logging.persist",
+			"Save logs on shutdown and load them at startup", NULL,
+			&persist_setting,
+			false,
+			PGC_SIGHUP,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.session_buffer_size",
+			"Sets size of the ring buffer for logs of the current session",
+			"The buffer is read by get_my_log(), zero disables it.",
+			&session_buffer_size_setting,
+			0,
+			0,
+			MaxAllocSize / 1024,
+			PGC_USERSET,
+			GUC_UNIT_KB,
+			NULL, session_buffer_size_assign_hook, NULL
+		);
+
+		DefineCustomStringVariable(
+			"pg_logging.load_database",
+			"Sets database the logs are loaded to",
+			"Loading is disabled if empty.",
+			&load_database_setting,
+			"",
+			PGC_POSTMASTER,
+			0,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomStringVariable(
+			"pg_logging.load_table",
+			"Sets table the logs are loaded to",
+			"The table is partitioned by days and created in the schema of "
+			"the extension.",
+			&load_table_setting,
+			"log_archive",
+			PGC_POSTMASTER,
+			0,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.load_batch_size",
+			"Sets number of logs loaded in one transaction", NULL,
+			&load_batch_size_setting,
+			1000,
+			1,
+			1000000,
+			PGC_SIGHUP,
+			0,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.load_interval",
+			"Sets time between loads", NULL,
+			&load_interval_setting,
+			10000,
+			1,
+			INT_MAX,
+			PGC_SIGHUP,
+			GUC_UNIT_MS,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.load_retention",
+			"Sets number of days loaded logs are kept",
+			"Older partitions are dropped, zero keeps them forever.",
+			&load_retention_setting,
+			0,
+			0,
+			INT_MAX,
+			PGC_SIGHUP,
+			0,
+			NULL, NULL, NULL
+		);
+	}
+	else
+	{
+		DefineCustomBoolVariable(
+			"pg_logging.enabled",
+			"Enable ring buffer for logs", NULL,
+			&hdr->logging_enabled,
+			true,
+			PGC_SUSET,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomBoolVariable(
+			"pg_logging.ignore_statements",
+			"Skip the lines generated by \"log_statement=all\"", NULL,
+			&hdr->ignore_statements,
+			false,
+			PGC_SUSET,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomBoolVariable(
+			"pg_logging.set_query_fields",
+			"Set query and query_pos fields", NULL,
+			&hdr->set_query_fields,
+			true,
+			PGC_SUSET,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomBoolVariable(
+			"pg_logging.store_templates",
+			"Store untranslated message formats",
+			"If the message is equal to its format, only the format is stored.",
+			&hdr->store_templates,
+			false,
+			PGC_SUSET,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomBoolVariable(
+			"pg_logging.collapse_repeats",
+			"Count repeated logs instead of storing them",
+			"A log with the same level, SQLSTATE and message as the previous "
+			"log of the backend increments its repeat count.",
+			&hdr->collapse_repeats,
+			false,
+			PGC_SUSET,
+			0, NULL, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.shed_horizon",
+			"Sets time logs should be kept in the buffer under load",
+			"When older logs are evicted sooner, logs of low levels are shed. "
+			"Zero disables shedding.",
+			&hdr->shed_horizon,
+			0,
+			0,
+			INT_MAX / 2,
+			PGC_SUSET,
+			GUC_UNIT_S,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomIntVariable(
+			"pg_logging.shed_sample",
+			"Keep one of this number of logs which are shed",
+			"Zero sheds all of them.",
+			&hdr->shed_sample,
+			0,
+			0,
+			INT_MAX,
+			PGC_SUSET,
+			0,
+			NULL, NULL, NULL
+		);
+
+		DefineCustomEnumVariable(
+			"pg_logging.minlevel",
+			"Set minimal log level to catch",
+			NULL,
+			&hdr->minlevel,
+			0,
+			level_options,
+			PGC_SUSET,
+			0, NULL, NULL, NULL
+		);
+	}
+}
+
+static void
+install_hooks(void)
+{
+	pg_logging_log_hook_next	= emit_log_hook;
+	emit_log_hook				= pg_logging_log_hook;
+	pg_logging_shmem_hook_next	= shmem_startup_hook;
+	shmem_startup_hook			= pg_logging_shmem_hook;
+}
+
+static void
+uninstall_hooks(void)
+{
+	emit_log_hook		= pg_logging_log_hook_next;
+	shmem_startup_hook	= pg_logging_shmem_hook_next;
+}
+
+/*
+ * Choose a partition for the item. OIDs are assigned sequentially so modulo
+ * is enough to spread tenants between partitions.
+ */
+int
+get_partition(Oid database_id, Oid user_id)
+{
+	switch (hdr->partition_by)
+	{
+		case PARTITION_DATABASE:
+			return database_id % hdr->npartitions;
+		case PARTITION_ROLE:
+			return user_id % hdr->npartitions;
+		default:
+			return 0;
+	}
+}
+
+LogRing *
+get_ring(int elevel, Oid database_id, Oid user_id)
+{
+	int		tier = 0;
+
+	if (hdr->ntiers > 1)
+	{
+		if (elevel >= ERROR)
+			tier = 2;
+		else if (elevel >= WARNING)
+			tier = 1;
+	}
+
+	return &hdr->rings[tier * hdr->npartitions +
+					   get_partition(database_id, user_id)];
+}
+
+static char *
+add_block(LogRing *ring, char *data, const char *block, int bytes_cp)
+{
+	char   *ringdata = RING_DATA(ring);
+	uint32	endpos = data - ringdata;
+
+	Assert(bytes_cp < ring->buffer_size);
+
+	if (bytes_cp)
+	{
+		if (bytes_cp < ring->buffer_size - endpos)
+		{
+			/* enough place to put */
+			memcpy(data, block, bytes_cp);
+			endpos += bytes_cp;
+			if (endpos == ring->buffer_size)
+				endpos = 0;
+		}
+		else
+		{
+			/* should add by two parts */
+			int size1 = ring->buffer_size - endpos;
+			int size2 = bytes_cp - size1;
+
+			memcpy(data, block, size1);
+			memcpy(ringdata, (char *) block + size1, size2);
+			endpos = size2;
+		}
+	}
+
+	return ringdata + endpos;
+}
+
+/*
+ * Counts the log in the bucket of its time interval. If the bucket still
+ * has an older interval it's cleared first, logs which are late for their
+ * interval (it was already replaced) are not counted.
+ */
+static void
+count_in_rollup(TimestampTz logtime, int elevel, int sqlerrcode)
+{
+	uint64			interval;
+	RollupBucket   *bucket;
+	uint64			key;
+	uint32			h;
+	int				i;
+
+	interval = logtime / ((int64) hdr->rollup_interval * USECS_PER_SEC);
+	bucket = &hdr->rollup[interval % ROLLUP_BUCKETS];
+	key = ROLLUP_KEY(MyDatabaseId, elevel, ERRCODE_TO_CATEGORY(sqlerrcode));
+	h = DatumGetUInt32(hash_uint32((uint32) (key ^ (key >> 32))));
+
+	if (pg_atomic_read_u64(&bucket->interval) != interval + 1)
+	{
+		SpinLockAcquire(&bucket->mutex);
+		if (pg_atomic_read_u64(&bucket->interval) < interval + 1)
+		{
+			for (i = 0; i < ROLLUP_SLOTS; i++)
+			{
+				pg_atomic_write_u64(&bucket->slots[i].key, 0);
+				pg_atomic_write_u32(&bucket->slots[i].count, 0);
+			}
+			pg_atomic_write_u32(&bucket->overflow, 0);
+			pg_write_barrier();
+			pg_atomic_write_u64(&bucket->interval, interval + 1);
+		}
+		SpinLockRelease(&bucket->mutex);
+
+		if (pg_atomic_read_u64(&bucket->interval) != interval + 1)
+			return;
+	}
+
+	for (i = 0; i < ROLLUP_SLOTS; i++)
+	{
+		RollupSlot *slot = &bucket->slots[(h + i) % ROLLUP_SLOTS];
+		uint64		cur = pg_atomic_read_u64(&slot->key);
+
+		if (cur == 0)
+		{
+			/* take the free slot, or see who took it */
+			if (pg_atomic_compare_exchange_u64(&slot->key, &cur, key))
+				cur = key;
+		}
+
+		if (cur == key)
+		{
+			pg_atomic_fetch_add_u32(&slot->count, 1);
+			return;
+		}
+	}
+
+	pg_atomic_fetch_add_u32(&bucket->overflow, 1);
+}
+
+/*
+ * Registers the item written from `start` to `end` in chunks of the ring.
+ * Chunks which the item only passes through don't have items started in
+ * them anymore.
+ */
+static void
+mark_chunks(LogRing *ring, uint32 start, uint32 end, uint64 seq)
+{
+	LogChunk   *chunks = RING_CHUNKS(ring);
+	int			c = RING_CHUNK(ring, start);
+	int			last = RING_CHUNK(ring, (end == 0 ? ring->buffer_size : end) - 1);
+
+	if (c != ring->last_chunk)
+	{
+		chunks[c].first = start;
+		chunks[c].seq = seq;
+	}
+	ring->last_chunk = c;
+
+	while (c != last)
+	{
+		c = (c + 1) % ring->nchunks;
+		chunks[c].first = INVALID_ITEM_POS;
+	}
+}
+
+/*
+ * Moves the oldest item position after the item from `start` to `end` was
+ * reserved over the oldest items, the space taken starts at `oldend`. Only
+ * items which start in the taken space are evicted, walking from the oldest
+ * one, so each item is looked at once when it's evicted. The oldest item
+ * left could share a chunk with newer items, then readers find it by the
+ * oldest item position of the ring.
+ */
+static void
+evict_items(LogRing *ring, uint32 oldend, uint32 start, uint32 end, uint64 seq)
+{
+	LogChunk   *chunks = RING_CHUNKS(ring);
+	uint32		len = RING_DISTANCE(ring, oldend, end);
+	int			c;
+
+	while (ring->first_seq < seq &&
+		   RING_DISTANCE(ring, oldend, RING_SUMMARY(ring, ring->first_seq)->pos) < len)
+		ring->first_seq++;
+
+	if (ring->first_seq == seq)
+	{
+		ring->firstpos = start;
+		return;
+	}
+	ring->firstpos = RING_SUMMARY(ring, ring->first_seq)->pos;
+
+	/* the new item only passes through the chunk of the oldest item */
+	c = RING_CHUNK(ring, ring->firstpos);
+	if (c != RING_CHUNK(ring, start) && chunks[c].first == INVALID_ITEM_POS)
+	{
+		chunks[c].first = ring->firstpos;
+		chunks[c].seq = ring->first_seq;
+	}
+}
+
+/*
+ * Levels below which logs are shed, each step sheds one more level. Errors
+ * are never shed.
+ */
+static const int shed_levels[] = {0, LOG, INFO, NOTICE, WARNING};
+
+#define SHED_CHECK_INTERVAL		USECS_PER_SEC
+
+/*
+ * Compares the retention horizon of the ring (age of the oldest item) with
+ * pg_logging.shed_horizon and sheds one level more if it's shorter, or one
+ * level less if it's half as long again. Checked at most once a second,
+ * so shedding has time to take effect. Should be called under the ring lock.
+ */
+static void
+check_retention(LogRing *ring, TimestampTz now)
+{
+	int64	target = (int64) hdr->shed_horizon * USECS_PER_SEC;
+	int64	horizon;
+	int		step = 0;
+
+	if (now - ring->shed_checked < SHED_CHECK_INTERVAL)
+		return;
+
+	ring->shed_checked = now;
+	while (shed_levels[step] != ring->shed_level)
+		step++;
+
+	if (ring->first_seq == ring->next_seq)
+		horizon = PG_INT64_MAX;		/* empty */
+	else
+		horizon = now - RING_SUMMARY(ring, ring->first_seq)->logtime;
+
+	if (target > 0 && horizon < target && step < lengthof(shed_levels) - 1)
+	{
+		ring->shed_level = shed_levels[step + 1];
+		ring->shed_raised++;
+	}
+	else if (step > 0 && (target == 0 || horizon >= target + target / 2))
+	{
+		ring->shed_level = shed_levels[step - 1];
+		ring->shed_relaxed++;
+	}
+}
+
+/*
+ * Called for logs below the shed level of their ring, returns false if the
+ * log should be kept anyway.
+ */
+static bool
+shed_item(LogRing *ring, int elevel)
+{
+	static uint32	nshed = 0;
+	TimestampTz		now = GetCurrentTimestamp();
+
+	/* the ring could be not written for a while, relax here too */
+	if (now - ring->shed_checked >= SHED_CHECK_INTERVAL)
+	{
+		RING_LOCK(ring);
+		check_retention(ring, now);
+		RING_RELEASE(ring);
+
+		if (elevel >= ring->shed_level)
+			return false;
+	}
+
+	if (hdr->shed_sample > 0 && ++nshed % hdr->shed_sample == 0)
+		return false;
+
+	pg_atomic_fetch_add_u64(&ring->shed_count, 1);
+	return true;
+}
+
+/*
+ * Looks for the string in the table of interned strings, probing at most
+ * INTERN_MAX_PROBES slots. Returns its id or 0, `free_slot` is set to the
+ * empty slot where the string could be added, or -1 if there is none.
+ */
+static int
+find_interned(const char *str, int len, uint32 hash, int *free_slot)
+{
+	int		i;
+
+	*free_slot = -1;
+	for (i = 0; i < INTERN_MAX_PROBES; i++)
+	{
+		int		slot = (hash + i) % MAX_INTERNED;
+		char   *entry;
+
+		if (hdr->interned[slot] == 0)
+		{
+			*free_slot = slot;
+			break;
+		}
+
+		entry = hdr->intern_arena + hdr->interned[slot] - 1;
+		if (strncmp(entry, str, len) == 0 && entry[len] == '\0')
+			return slot + 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns id of the string in shared memory, adding it if needed. The table
+ * is looked through under a shared lock, the exclusive lock is taken only if
+ * the string could be added.
+ */
+static int
+intern_string_in_shmem(const char *str)
+{
+	int		len = strlen(str);
+	uint32	hash;
+	int		id;
+	int		slot;
+
+	if (len >= MAX_INTERNED_LEN)
+		len = pg_mbcliplen(str, len, MAX_INTERNED_LEN - 1);
+
+	hash = DatumGetUInt32(hash_any((const unsigned char *) str, len));
+
+	HDR_LOCK_SHARED();
+	id = find_interned(str, len, hash, &slot);
+	HDR_RELEASE();
+
+	if (id != 0 || slot < 0 ||
+		hdr->intern_arena_used + len + 1 > INTERN_ARENA_SIZE)
+		return id;
+
+	HDR_LOCK();
+	/* the string could be added meanwhile */
+	id = find_interned(str, len, hash, &slot);
+	if (id == 0 && slot >= 0 &&
+		hdr->intern_arena_used + len + 1 <= INTERN_ARENA_SIZE)
+	{
+		char   *entry = hdr->intern_arena + hdr->intern_arena_used;
+
+		memcpy(entry, str, len);
+		entry[len] = '\0';
+
+		/* the entry is read without the lock once it's in the table */
+		pg_write_barrier();
+		hdr->interned[slot] = hdr->intern_arena_used + 1;
+		hdr->intern_arena_used += len + 1;
+		id = slot + 1;
+	}
+	HDR_RELEASE();
+
+	return id;
+}
+
+/*
+ * Returns id of the string, or 0 if the table of interned strings is full.
+ * A cached id is checked against the string, in case some string was not
+ * a constant. Misses are cached too, so once the table is full the hook
+ * doesn't look through it for each log.
+ */
+static int
+intern_string(const char *str)
+{
+	int		slot;
+
+	if (str == NULL)
+		return 0;
+
+	slot = ((uintptr_t) str >> 3) % INTERN_CACHE_SIZE;
+	if (intern_cache[slot].str != str ||
+		(intern_cache[slot].id != 0 &&
+		 strncmp(get_interned_string(intern_cache[slot].id), str,
+				 MAX_INTERNED_LEN - 1) != 0))
+	{
+		intern_cache[slot].str = str;
+		intern_cache[slot].id = intern_string_in_shmem(str);
+	}
+
+	return intern_cache[slot].id;
+}
+
+const char *
+get_interned_string(int id)
+{
+	if (id <= 0 || id > MAX_INTERNED || hdr->interned[id - 1] == 0)
+		return NULL;
+
+	return hdr->intern_arena + hdr->interned[id - 1] - 1;
+}
+
+int
+compile_filter_regex(const char *pattern, regex_t *re)
+{
+	int			len = strlen(pattern);
+	pg_wchar   *wpattern = palloc((len + 1) * sizeof(pg_wchar));
+	int			wlen = pg_mb2wchar_with_len(pattern, wpattern, len);
+	int			rc;
+
+	rc = pg_regcomp(re, wpattern, wlen, REG_ADVANCED | REG_NOSUB,
+					DEFAULT_COLLATION_OID);
+	pfree(wpattern);
+	return rc;
+}
+
+/*
+ * Make local copy of filters if they were changed in shared memory.
+ * Regular expressions are compiled once here, not on each log line.
+ */
+static void
+load_filters(void)
+{
+	int				i,
+					count;
+	MemoryContext	old_mcxt;
+
+	for (i = 0; i < nfilters; i++)
+	{
+		if (filters_regex[i])
+		{
+			pg_regfree(filters_regex[i]);
+			pfree(filters_regex[i]);
+			filters_regex[i] = NULL;
+		}
+	}
+
+	HDR_LOCK();
+	filters_gen = hdr->filters_gen;
+	nfilters = hdr->nfilters;
+	memcpy(filters, hdr->filters, sizeof(LogFilter) * nfilters);
+	HDR_RELEASE();
+
+	old_mcxt = MemoryContextSwitchTo(TopMemoryContext);
+	for (i = 0, count = 0; i < nfilters; i++)
+	{
+		regex_t	*re = NULL;
+
+		if (filters[i].regex[0] != '\0')
+		{
+			re = palloc(sizeof(regex_t));
+			if (compile_filter_regex(filters[i].regex, re) != REG_OKAY)
+			{
+				/* it was checked on adding, so just skip the filter */
+				pfree(re);
+				continue;
+			}
+		}
+
+		filters[count] = filters[i];
+		filters_regex[count++] = re;
+	}
+	nfilters = count;
+	MemoryContextSwitchTo(old_mcxt);
+}
+
+static bool
+filter_matches(LogFilter *filter, regex_t *re, ErrorData *edata, Oid user_id)
+{
+	if (OidIsValid(filter->database_id) && filter->database_id != MyDatabaseId)
+		return false;
+
+	if (OidIsValid(filter->user_id) && filter->user_id != user_id)
+		return false;
+
+	if (filter->has_errcode)
+	{
+		if (filter->errclass)
+		{
+			if (ERRCODE_TO_CATEGORY(edata->sqlerrcode) != filter->sqlerrcode)
+				return false;
+		}
+		else if (edata->sqlerrcode != filter->sqlerrcode)
+			return false;
+	}
+
+	if (re)
+	{
+		pg_wchar   *wmessage;
+		int			len,
+					wlen,
+					rc;
+
+		if (edata->message == NULL)
+			return false;
+
+		len = strlen(edata->message);
+		wmessage = palloc((len + 1) * sizeof(pg_wchar));
+		wlen = pg_mb2wchar_with_len(edata->message, wmessage, len);
+
+		HOLD_INTERRUPTS();
+		rc = pg_regexec(re, wmessage, wlen, 0, NULL, 0, NULL, 0);
+		RESUME_INTERRUPTS();
+		pfree(wmessage);
+
+		if (rc != REG_OKAY)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Returns true if the item should not be saved. Filters without regular
+ * expressions are checked first, since they need only integer comparisons.
+ */
+static bool
+item_filtered_out(ErrorData *edata, Oid user_id)
+{
+	int		i,
+			pass;
+	bool	has_include = false,
+			included = false;
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (i = 0; i < nfilters; i++)
+		{
+			LogFilter  *filter = &filters[i];
+
+			if ((pass == 0) != (filters_regex[i] == NULL))
+				continue;
+
+			if (!filter->exclude)
+			{
+				has_include = true;
+				if (included)
+					continue;
+			}
+
+			if (!filter_matches(filter, filters_regex[i], edata, user_id))
+				continue;
+
+			if (filter->exclude)
+				return true;
+
+			included = true;
+		}
+	}
+
+	return has_include && !included;
+}
 
 static void
-buffer_size_assign_hook(int newval, void *extra)
+fill_hook_cache(void)
 {
-	if (!shmem_initialized)
+	if (MyBackendId == InvalidBackendId)
 		return;
 
-	newval = newval * 1024;
-	if (newval > hdr->buffer_size_initial)
-		elog(ERROR, "buffer size cannot be increased");
-
-	reset_counters_in_shmem(newval);
+	hook_cache.has_user = !IsAutoVacuumLauncherProcess() &&
+		!IsAutoVacuumWorkerProcess();
+	hook_cache.initialized = true;
 }
 
-static const struct config_enum_entry level_options[] = {
-	{"none", 0, true},
-	{"debug", DEBUG2, true},
-	{"debug5", DEBUG5, false},
-	{"debug4", DEBUG4, false},
-	{"debug3", DEBUG3, false},
-	{"debug2", DEBUG2, false},
-	{"debug1", DEBUG1, false},
-	{"log", LOG, false},
-	{"info", INFO, true},
-	{"notice", NOTICE, false},
-	{"warning", WARNING, false},
-	{"error", ERROR, false},
-	{"fatal", FATAL, false},
-	{"panic", PANIC, false},
-	{NULL, 0, false}
-};
-
-static void
-setup_gucs(bool basic)
+static const char *
+get_vxid(void)
 {
-	if (basic)
+	if (hook_cache.vxid_len == 0 || hook_cache.lxid != MyProc->lxid)
 	{
-		DefineCustomIntVariable(
-			"pg_logging.buffer_size",
-			"Sets size of the ring buffer used to keep logs", NULL,
-			&buffer_size_setting,
-			1024 * 10, /* 10MB */
-			1024,
-			INT_MAX,
-			PGC_SUSET,
-			GUC_UNIT_KB,
-			NULL, buffer_size_assign_hook, NULL
-		);
+#ifdef XID_FMT
+		snprintf(hook_cache.vxid, sizeof(hook_cache.vxid), "%d/" XID_FMT,
+					MyProc->backendId, MyProc->lxid);
+#else
+		snprintf(hook_cache.vxid, sizeof(hook_cache.vxid), "%d/%u",
+					MyProc->backendId, MyProc->lxid);
+#endif
+		hook_cache.vxid_len = strlen(hook_cache.vxid);
+		hook_cache.lxid = MyProc->lxid;
 	}
-	else
-	{
-		DefineCustomBoolVariable(
-			"pg_logging.enabled",
-			"Enable ring buffer for logs", NULL,
-			&hdr->logging_enabled,
-			true,
-			PGC_SUSET,
-			0, NULL, NULL, NULL
-		);
-
-		DefineCustomBoolVariable(
-			"pg_logging.ignore_statements",
-			"Skip the lines generated by \"log_statement=all\"", NULL,
-			&hdr->ignore_statements,
-			false,
-			PGC_SUSET,
-			0, NULL, NULL, NULL
-		);
-
-		DefineCustomBoolVariable(
-			"pg_logging.set_query_fields",
-			"Set query and query_pos fields", NULL,
-			&hdr->set_query_fields,
-			true,
-			PGC_SUSET,
-			0, NULL, NULL, NULL
-		);
 
-		DefineCustomEnumVariable(
-			"pg_logging.minlevel",
-			"Set minimal log level to catch",
-			NULL,
-			&hdr->minlevel,
-			0,
-			level_options,
-			PGC_SUSET,
-			0, NULL, NULL, NULL
-		);
-	}
+	return hook_cache.vxid;
 }
 
-static void
-install_hooks(void)
+static const char *
+get_sqlstate(int sqlerrcode)
 {
-	pg_logging_log_hook_next	= emit_log_hook;
-	emit_log_hook				= pg_logging_log_hook;
-	pg_logging_shmem_hook_next	= shmem_startup_hook;
-	shmem_startup_hook			= pg_logging_shmem_hook;
+	if (hook_cache.sqlstate[0] == '\0' || hook_cache.sqlerrcode != sqlerrcode)
+	{
+		strlcpy(hook_cache.sqlstate, unpack_sql_state(sqlerrcode),
+				sizeof(hook_cache.sqlstate));
+		hook_cache.sqlerrcode = sqlerrcode;
+	}
+
+	return hook_cache.sqlstate;
 }
 
+/*
+ * Blocks of an item in the order they follow the header, the ordering is
+ * important, look pl_funcs.c  !!!
+ */
 static void
-uninstall_hooks(void)
+get_item_blocks(ItemBlock *blocks, CollectedItem *item, ErrorData *edata,
+				const char *sqlstate, const char *remote_host,
+				const char *psdisp, const char *vxid)
 {
-	emit_log_hook		= pg_logging_log_hook_next;
-	shmem_startup_hook	= pg_logging_shmem_hook_next;
+#define SET_BLOCK(i, str, len) \
+	(blocks[(i)].data = (str), blocks[(i)].len = (len))
+
+	SET_BLOCK(0, edata->message, item->message_len);
+	SET_BLOCK(1, edata->detail, item->detail_len);
+	SET_BLOCK(2, edata->detail_log, item->detail_log_len);
+	SET_BLOCK(3, edata->hint, item->hint_len);
+	SET_BLOCK(4, edata->context, item->context_len);
+	SET_BLOCK(5, edata->domain, item->domain_len);
+	SET_BLOCK(6, edata->context_domain, item->context_domain_len);
+	SET_BLOCK(7, edata->internalquery, item->internalquery_len);
+	SET_BLOCK(8, sqlstate, item->errstate_len);
+	SET_BLOCK(9, application_name, item->appname_len);
+	SET_BLOCK(10, remote_host, item->remote_host_len);
+	SET_BLOCK(11, psdisp, item->command_tag_len);
+	SET_BLOCK(12, vxid, item->vxid_len);
+	SET_BLOCK(13, debug_query_string, item->query_len);
+	SET_BLOCK(14, edata->schema_name, item->schema_name_len);
+	SET_BLOCK(15, edata->table_name, item->table_name_len);
+	SET_BLOCK(16, edata->column_name, item->column_name_len);
+	SET_BLOCK(17, edata->datatype_name, item->datatype_name_len);
+	SET_BLOCK(18, edata->constraint_name, item->constraint_name_len);
+
+#undef SET_BLOCK
 }
 
-static char *
-add_block(char *data, const char *block, int bytes_cp)
+/*
+ * Copies the item to the session ring, evicting the oldest items of the
+ * session. The item is built from the same local data as in the shared
+ * ring, since the shared copy could be overwritten by other backends as
+ * soon as it's complete. Returns false if the item was not copied.
+ */
+static bool
+copy_to_session_ring(CollectedItem *item, ItemBlock *blocks)
 {
-	uint32 endpos = data - hdr->data;
+	SessionRing	   *sr = &session_ring;
+	uint32			size = session_buffer_size_setting * 1024;
+	uint32			len = item->totallen;
+	char		   *data;
+	int				i;
 
-	Assert(bytes_cp < hdr->buffer_size);
+	if (sr->reading)
+		return false;
 
-	if (bytes_cp)
+	if (sr->size != size)
+	{
+		if (sr->data)
+			pfree(sr->data);
+		sr->data = MemoryContextAllocExtended(TopMemoryContext, size,
+											  MCXT_ALLOC_NO_OOM);
+		sr->size = sr->data ? size : 0;
+		sr->first = sr->end = 0;
+		sr->wrapped = false;
+		sr->nitems = 0;
+	}
+
+	if (len > sr->size)
+		return false;
+
+	for (;;)
 	{
-		if (bytes_cp < hdr->buffer_size - endpos)
+		if (!sr->wrapped)
 		{
-			/* enough place to put */
-			memcpy(data, block, bytes_cp);
-			endpos += bytes_cp;
-			if (endpos == hdr->buffer_size)
-				endpos = 0;
+			if (sr->end + len <= sr->size)
+				break;
+
+			/* continue from the start */
+			sr->tail = sr->end;
+			sr->end = 0;
+			sr->wrapped = true;
 		}
+		else if (sr->end + len <= sr->first)
+			break;
 		else
 		{
-			/* should add by two parts */
-			int size1 = hdr->buffer_size - endpos;
-			int size2 = bytes_cp - size1;
-
-			memcpy(data, block, size1);
-			memcpy(hdr->data, (char *) block + size1, size2);
-			endpos = size2;
+			/* evict the oldest item */
+			sr->first += ((CollectedItem *) (sr->data + sr->first))->totallen;
+			sr->nitems--;
+			if (sr->first == sr->tail)
+			{
+				sr->first = 0;
+				sr->wrapped = false;
+			}
 		}
 	}
 
-	return hdr->data + endpos;
+	data = sr->data + sr->end;
+	memcpy(data, item, ITEM_HDR_LEN);
+	data += ITEM_HDR_LEN;
+	for (i = 0; i < ITEM_NBLOCKS; i++)
+	{
+		if (blocks[i].len)
+			memcpy(data, blocks[i].data, blocks[i].len);
+		data += blocks[i].len;
+	}
+
+	sr->last = sr->end;
+	sr->end += len;
+	sr->nitems++;
+	return true;
 }
 
-static int
-push_reading_position(int readpos, bool *wrapped)
+/* Checks that items of the chain were evicted or flushed */
+static bool
+chain_is_stale(BackendChain *chain)
+{
+	if (chain->ring < 0 || chain->ring >= hdr->nrings)
+		return true;
+
+	return chain->seq < hdr->rings[chain->ring].read_seq;
+}
+
+/*
+ * Returns the chain of this backend. Chains are found by pid with linear
+ * probing from CHAIN_SLOT(pid, 0), so chains of exited backends stay while
+ * their logs are in the rings. A new chain takes a free entry or an entry
+ * whose logs are gone, and if there is none, the first entry of its probe.
+ * Should be called without ring locks.
+ */
+static BackendChain *
+get_backend_chain(void)
 {
-	CollectedItem *item;
+	BackendChain   *chain;
+	int				found = -1;
+	int				i;
+
+	if (my_chain >= 0 && hdr->chains[my_chain].pid == MyProcPid)
+		return &hdr->chains[my_chain];
 
-	*wrapped = false;
-	if (readpos + ITEM_HDR_LEN > hdr->buffer_size)
+	HDR_LOCK();
+	for (i = 0; i < MAX_CHAINS; i++)
 	{
-		readpos = 0;
-		*wrapped = true;
+		int		slot = CHAIN_SLOT(MyProcPid, i);
 
-#ifdef CHECK_DATA
-		Assert(((CollectedItem *) hdr->data)->magic == PG_ITEM_MAGIC);
-#endif
+		chain = &hdr->chains[slot];
+		if (chain->pid == MyProcPid)
+		{
+			found = slot;
+			break;
+		}
+
+		if (chain->pid == 0)
+		{
+			if (found < 0)
+				found = slot;
+			break;
+		}
 
+		if (found < 0 && chain_is_stale(chain))
+			found = slot;
 	}
-	else
+	if (found < 0)
+		found = CHAIN_SLOT(MyProcPid, 0);
+
+	chain = &hdr->chains[found];
+	MemSet(chain, 0, sizeof(BackendChain));
+	chain->pid = MyProcPid;
+	chain->ring = -1;
+	HDR_RELEASE();
+
+	my_chain = found;
+	return chain;
+}
+
+/*
+ * If the previous item of this backend has the same level, SQLSTATE and
+ * message (compared by hash), counts the log as its repeat. Returns false
+ * if a new item should be written.
+ */
+static bool
+repeat_last_item(ErrorData *edata, uint32 hash)
+{
+	LogRing		   *ring;
+	ItemSummary	   *summary;
+	CollectedItem  *item;
+	TimestampTz		now;
+	bool			found = false;
+
+	if (last_item.ring < 0 || last_item.hash != hash ||
+		last_item.elevel != edata->elevel ||
+		last_item.sqlerrcode != edata->sqlerrcode ||
+		last_item.txid != GetTopTransactionIdIfAny())
+		return false;
+
+	ring = &hdr->rings[last_item.ring];
+	if (LWLockHeldByMe(&ring->lock.lock))
+		return false;
+
+	now = GetCurrentTimestamp();
+	RING_LOCK(ring);
+	summary = RING_SUMMARY(ring, last_item.seq);
+	if (last_item.seq >= ring->first_seq && last_item.seq < ring->next_seq &&
+		summary->written == (uint32) last_item.seq && summary->ppid == MyProcPid)
 	{
-		int tail;
+		item = (CollectedItem *) (RING_DATA(ring) + summary->pos);
+		item->repeat_count++;
+		item->last_logtime = now;
+		found = true;
+	}
+	RING_RELEASE(ring);
 
-		item = (CollectedItem *) (hdr->data + readpos);
-#ifdef CHECK_DATA
-		Assert(item->magic == PG_ITEM_MAGIC);
-#endif
-		readpos += item->totallen;
-		tail = readpos - hdr->buffer_size;
-		if (tail > 0) {
-			readpos = tail;
-			*wrapped = true;
-		}
+	if (!found)
+	{
+		last_item.ring = -1;
+		return false;
 	}
-	if (!buffer_increase_suggested)
+
+	if (last_item.in_session && session_ring.nitems > 0 && !session_ring.reading)
 	{
-		fprintf(stderr, "CONSIDER INCREASING PG_LOGGING BUFFER");
-		buffer_increase_suggested = true;
+		item = (CollectedItem *) (session_ring.data + session_ring.last);
+		item->repeat_count++;
+		item->last_logtime = now;
 	}
 
-	return readpos;
+	return true;
 }
 
-static void
+void
 copy_error_data_to_shmem(ErrorData *edata)
 {
 #define ADD_STRING(totallen, string_len, string) \
@@ -240,15 +1355,23 @@ copy_error_data_to_shmem(ErrorData *edata)
 
 	static bool		log_in_process = false;
 	static uint64	log_line_number = 0;
+	LogRing		   *ring;
 	char		   *data;
-	int				wrap = WRAP_NONE;
 	CollectedItem	item;
+	ItemSummary	   *summary;
+	BackendChain   *chain;
 	uint32			endpos,
-					curpos,
+					oldend,
 					savedpos;
+	uint64			seq;
 	const char	   *psdisp = NULL,
-				   *remote_host = NULL;
-	char			vxidbuf[128];
+				   *remote_host = NULL,
+				   *vxid = NULL,
+				   *sqlstate;
+	uint32			hash = 0;
+	bool			evicted_old = false;
+	ItemBlock		blocks[ITEM_NBLOCKS];
+	int				i;
 
 	/* don't allow recursive logs or quit if logs are disabled */
 	if (log_in_process || !hdr->logging_enabled)
@@ -262,11 +1385,63 @@ copy_error_data_to_shmem(ErrorData *edata)
 
 	log_in_process = true;
 
+	if (!hook_cache.initialized)
+		fill_hook_cache();
+
+	/* rollups count logs which are shed, filtered out or repeated too */
+	item.logtime = GetCurrentTimestamp();
+	count_in_rollup(item.logtime, edata->elevel, edata->sqlerrcode);
+
+	if (hook_cache.has_user)
+		item.user_id = GetSessionUserId();
+	else
+		item.user_id = InvalidOid;
+
+	/*
+	 * An error raised while this backend reads the ring (or holds hdr_lock)
+	 * is reported before the locks are released, skip it instead of waiting
+	 * for ourselves.
+	 */
+	ring = get_ring(edata->elevel, MyDatabaseId, item.user_id);
+	if (LWLockHeldByMe(&ring->lock.lock) || LWLockHeldByMe(&hdr->hdr_lock.lock))
+	{
+		log_in_process = false;
+		return;
+	}
+
+	/* checking the shed level is all the cost when not shedding */
+	if (edata->elevel < ring->shed_level && shed_item(ring, edata->elevel))
+	{
+		log_in_process = false;
+		return;
+	}
+
+	pg_read_barrier();
+	if (filters_gen != hdr->filters_gen)
+		load_filters();
+
+	if (nfilters && item_filtered_out(edata, item.user_id))
+	{
+		log_in_process = false;
+		return;
+	}
+
+	if (hdr->collapse_repeats)
+	{
+		if (edata->message)
+			hash = DatumGetUInt32(hash_any((const unsigned char *) edata->message,
+										   strlen(edata->message)));
+		if (repeat_last_item(edata, hash))
+		{
+			log_in_process = false;
+			return;
+		}
+	}
+
 	/* calculate length */
 #ifdef CHECK_DATA
 	item.magic = PG_ITEM_MAGIC;
 #endif
-	item.logtime = GetCurrentTimestamp();
 	item.totallen = ITEM_HDR_LEN;
 	item.elevel = edata->elevel;
 	item.saved_errno = edata->saved_errno;
@@ -278,12 +1453,8 @@ copy_error_data_to_shmem(ErrorData *edata)
 	item.remote_host_len = 0;
 	item.command_tag_len = 0;
 	item.session_start_time = 0;
-
-	if (MyBackendId != InvalidBackendId && !IsAutoVacuumLauncherProcess() &&
-		!IsAutoVacuumWorkerProcess())
-		item.user_id = GetSessionUserId();
-	else
-		item.user_id = InvalidOid;
+	item.repeat_count = 0;
+	item.last_logtime = 0;
 
 	/* transaction */
 	item.txid = GetTopTransactionIdIfAny();
@@ -291,14 +1462,8 @@ copy_error_data_to_shmem(ErrorData *edata)
 
 	if (MyProc != NULL && MyProc->backendId != InvalidBackendId)
 	{
-#ifdef XID_FMT
-		snprintf(vxidbuf, sizeof(vxidbuf) - 1, "%d/" XID_FMT,
-					MyProc->backendId, MyProc->lxid);
-#else
-		snprintf(vxidbuf, sizeof(vxidbuf) - 1, "%d/%u",
-					MyProc->backendId, MyProc->lxid);
-#endif
-		item.totallen += (item.vxid_len = strlen(vxidbuf));
+		vxid = get_vxid();
+		item.totallen += (item.vxid_len = hook_cache.vxid_len);
 	}
 
 	if (MyProcPort)
@@ -326,7 +1491,19 @@ copy_error_data_to_shmem(ErrorData *edata)
 		ADD_STRING(item.totallen, item.query_len, debug_query_string);
 	}
 
-	ADD_STRING(item.totallen, item.message_len, edata->message);
+	item.template_id = 0;
+	item.flags = 0;
+	if (hdr->store_templates && edata->message_id)
+	{
+		item.template_id = intern_string(edata->message_id);
+		if (item.template_id && edata->message &&
+			strlen(edata->message) < MAX_INTERNED_LEN &&
+			strcmp(edata->message, edata->message_id) == 0)
+			item.flags |= ITEM_MESSAGE_IS_TEMPLATE;
+	}
+
+	ADD_STRING(item.totallen, item.message_len,
+			   (item.flags & ITEM_MESSAGE_IS_TEMPLATE) ? NULL : edata->message);
 	ADD_STRING(item.totallen, item.detail_len, edata->detail);
 	ADD_STRING(item.totallen, item.detail_log_len, edata->detail_log);
 	ADD_STRING(item.totallen, item.hint_len, edata->hint);
@@ -335,101 +1512,219 @@ copy_error_data_to_shmem(ErrorData *edata)
 	ADD_STRING(item.totallen, item.context_domain_len, edata->context_domain);
 	ADD_STRING(item.totallen, item.appname_len, application_name);
 	ADD_STRING(item.totallen, item.internalquery_len, edata->internalquery);
-	ADD_STRING(item.totallen, item.errstate_len, unpack_sql_state(edata->sqlerrcode));
+	sqlstate = get_sqlstate(edata->sqlerrcode);
+	ADD_STRING(item.totallen, item.errstate_len, sqlstate);
+	ADD_STRING(item.totallen, item.schema_name_len, edata->schema_name);
+	ADD_STRING(item.totallen, item.table_name_len, edata->table_name);
+	ADD_STRING(item.totallen, item.column_name_len, edata->column_name);
+	ADD_STRING(item.totallen, item.datatype_name_len, edata->datatype_name);
+	ADD_STRING(item.totallen, item.constraint_name_len, edata->constraint_name);
 	item.totallen = INTALIGN(item.totallen);
 
+	if (edata->constraint_name)
+		item.object_type = IOT_CONSTRAINT;
+	else if (edata->column_name)
+		item.object_type = IOT_COLUMN;
+	else if (edata->datatype_name)
+		item.object_type = IOT_DATATYPE;
+	else if (edata->table_name)
+		item.object_type = IOT_TABLE;
+	else
+		item.object_type = IOT_NONE;
+
+	item.filename_id = intern_string(edata->filename);
+	item.lineno = edata->lineno;
+	item.funcname_id = intern_string(edata->funcname);
+
+	chain = get_backend_chain();
+
 	/*
-	 * Find the place to put the block.
-	 * First  check the header, it there is not enough place for the header
-	 * move to the beginning.
-	 * Then check the place with the data and calculate the position
-	 * according to data length.
-	 *
-	 * We use reading position here from written data and have to use lock.
-	 * Also reading position will be moved forward if needed.
+	 * Reserve space for the item. The header is never split, so if it
+	 * doesn't fit to the end of the ring, the item goes from the start.
+	 * Only oldest items which start in the reserved space are evicted.
 	 */
-	HDR_LOCK();
-	savedpos = curpos = hdr->endpos;
+	RING_LOCK(ring);
+	if (item.totallen + ring->chunk_size >= ring->buffer_size)
+	{
+		/* should not happen if the buffer is large enough */
+		RING_RELEASE(ring);
+		log_in_process = false;
+		elog(LOG, "pg_logging buffer overflow");
+		return;
+	}
 
-	if (savedpos + ITEM_HDR_LEN > hdr->buffer_size)
+	oldend = savedpos = ring->endpos;
+	if (savedpos + ITEM_HDR_LEN > ring->buffer_size)
 	{
+		LogChunk   *chunks = RING_CHUNKS(ring);
+		int			c = RING_CHUNK(ring, savedpos);
+
+		/* no items could start in the rest of the ring */
+		if (c == ring->last_chunk && savedpos % ring->chunk_size != 0)
+			c++;
+		for (; c < ring->nchunks; c++)
+			chunks[c].first = INVALID_ITEM_POS;
+
 		savedpos = 0;
-		endpos = item.totallen;
-		wrap = WRAP_FULL;
 	}
-	else
+
+	endpos = (savedpos + item.totallen) % ring->buffer_size;
+	seq = ring->next_seq++;
+	mark_chunks(ring, savedpos, endpos, seq);
+
+	if (ring->first_seq == seq)
+		ring->firstpos = savedpos;	/* was empty */
+	else if (RING_DISTANCE(ring, oldend, ring->firstpos) <
+			 RING_DISTANCE(ring, oldend, endpos))
 	{
-		endpos = savedpos + item.totallen;
-		if (endpos >= hdr->buffer_size)
-		{
-			endpos = endpos - hdr->buffer_size;
-			wrap = WRAP_PARTIAL;
-		}
+		evict_items(ring, oldend, savedpos, endpos, seq);
+		evicted_old = true;
 	}
-	hdr->endpos = endpos;
 
-	if (wrap)
+	/* move reading position if everything was read or unread logs evicted */
+	if (ring->readpos == oldend && !ring->wraparound)
 	{
-		bool rwrap = false;
-
-		hdr->wraparound = true;
-		if (wrap == WRAP_PARTIAL && savedpos < hdr->readpos)
-		{
-			while (!rwrap)
-				hdr->readpos = push_reading_position(hdr->readpos, &rwrap);
-		}
-
-		rwrap = false;
-		while (hdr->readpos < endpos)
-			hdr->readpos = push_reading_position(hdr->readpos, &rwrap);
-		Assert(!rwrap);
+		ring->readpos = savedpos;
+		ring->read_seq = seq;
+	}
+	else if (ring->read_seq < ring->first_seq)
+	{
+		ring->readpos = ring->firstpos;
+		ring->read_seq = ring->first_seq;
 	}
-	else if (hdr->wraparound)
+	ring->endpos = endpos;
+	ring->wraparound = ring->readpos > endpos;
+
+	summary = RING_SUMMARY(ring, seq);
+	summary->logtime = item.logtime;
+	summary->seq = seq;
+	summary->pos = savedpos;
+	summary->totallen = item.totallen;
+	summary->elevel = item.elevel;
+	summary->ppid = item.ppid;
+	summary->database_id = item.database_id;
+	summary->user_id = item.user_id;
+	summary->sqlerrcode = item.sqlerrcode;
+	summary->txid = item.txid;
+	summary->written = ~((uint32) seq);
+
+	if (evicted_old)
+		check_retention(ring, item.logtime);
+
+	/* link the item to the chain of this backend, unless it was taken */
+	summary->prev_ring = -1;
+	if (chain->pid == MyProcPid)
 	{
-		bool rwrap = false;
+		if (chain->ring >= 0)
+		{
+			summary->prev_ring = chain->ring;
+			summary->prev_seq = chain->seq;
+		}
+		chain->ring = ring - hdr->rings;
+		chain->seq = seq;
 
-		while (hdr->readpos < endpos)
+		if (TransactionIdIsValid(item.txid))
 		{
-			hdr->readpos = push_reading_position(hdr->readpos, &rwrap);
-			if (rwrap)
+			ChainXact  *xact = &chain->xacts[chain->last_xact];
+
+			if (xact->txid != item.txid)
 			{
-				hdr->wraparound = false;
-				break;
+				chain->last_xact = (chain->last_xact + 1) % CHAIN_XACTS;
+				xact = &chain->xacts[chain->last_xact];
+				xact->txid = item.txid;
 			}
+			xact->ring = chain->ring;
+			xact->seq = seq;
 		}
 	}
-	HDR_RELEASE();
+	RING_RELEASE(ring);
+
+	/* copy the data, the space is reserved for us */
+	data = RING_DATA(ring) + savedpos;
+	Assert(data < (RING_DATA(ring) + ring->buffer_size));
+	memcpy(data, &item, ITEM_HDR_LEN);
+	data += ITEM_HDR_LEN;
+
+	get_item_blocks(blocks, &item, edata, sqlstate, remote_host, psdisp, vxid);
+	for (i = 0; i < ITEM_NBLOCKS; i++)
+		data = add_block(ring, data, blocks[i].data, blocks[i].len);
+
+	/* the item is complete */
+	pg_write_barrier();
+	summary->written = (uint32) seq;
+
+	last_item.in_session = (session_buffer_size_setting > 0 &&
+							copy_to_session_ring(&item, blocks));
+
+	last_item.ring = hdr->collapse_repeats ? ring - hdr->rings : -1;
+	last_item.seq = seq;
+	last_item.elevel = item.elevel;
+	last_item.sqlerrcode = item.sqlerrcode;
+	last_item.hash = hash;
+	last_item.txid = item.txid;
+	log_in_process = false;
+}
 
-	if (hdr->endpos >= savedpos && hdr->endpos < endpos)
-	{
-		/* should not happen if the buffer is large enough */
-		log_in_process = false;
-		elog(LOG, "pg_logging buffer overflow");
-	}
-	else
+/*
+ * Split the buffer between rings, should be called with all rings locked
+ * or before anyone could use them.
+ */
+void
+setup_rings(int buffer_size)
+{
+	int		i,
+			j;
+	uint32	offset = 0,
+			chunks_offset = 0,
+			summary_offset = 0;
+
+	hdr->buffer_size = buffer_size;
+	for (i = 0; i < hdr->nrings; i++)
 	{
-		data = hdr->data + savedpos;
-		Assert(data < (hdr->data + hdr->buffer_size));
-		memcpy(data, &item, ITEM_HDR_LEN);
-		data += ITEM_HDR_LEN;
-
-		/* ordering is important, look pl_funcs.c  !!! */
-		data = add_block(data, edata->message, item.message_len);
-		data = add_block(data, edata->detail, item.detail_len);
-		data = add_block(data, edata->detail_log, item.detail_log_len);
-		data = add_block(data, edata->hint, item.hint_len);
-		data = add_block(data, edata->context, item.context_len);
-		data = add_block(data, edata->domain, item.domain_len);
-		data = add_block(data, edata->context_domain, item.context_domain_len);
-		data = add_block(data, edata->internalquery, item.internalquery_len);
-		data = add_block(data, unpack_sql_state(edata->sqlerrcode), item.errstate_len);
-		data = add_block(data, application_name, item.appname_len);
-		data = add_block(data, remote_host, item.remote_host_len);
-		data = add_block(data, psdisp, item.command_tag_len);
-		data = add_block(data, vxidbuf, item.vxid_len);
-		add_block(data, debug_query_string, item.query_len);
-		log_in_process = false;
+		LogRing *ring = &hdr->rings[i];
+		int		 tier = i / hdr->npartitions;
+		uint32	 tier_size = buffer_size;
+
+		if (hdr->ntiers > 1)
+			tier_size = buffer_size / 100 * hdr->tier_split[tier];
+
+		ring->offset = offset;
+		ring->buffer_size = TYPEALIGN_DOWN(MAXIMUM_ALIGNOF,
+										   tier_size / hdr->npartitions);
+		ring->readpos = 0;
+		ring->endpos = 0;
+		ring->wraparound = false;
+		offset += ring->buffer_size;
+
+		/* small rings still get a few chunks */
+		ring->chunk_size = Min(LOG_CHUNK_SIZE,
+							   MAXALIGN((ring->buffer_size + MIN_RING_CHUNKS - 1) /
+										MIN_RING_CHUNKS));
+		ring->chunk_size = Max(ring->chunk_size, MAXIMUM_ALIGNOF);
+		ring->nchunks = (ring->buffer_size + ring->chunk_size - 1) / ring->chunk_size;
+		ring->chunks_offset = chunks_offset;
+		ring->last_chunk = -1;
+		for (j = 0; j < ring->nchunks; j++)
+			RING_CHUNKS(ring)[j].first = INVALID_ITEM_POS;
+		chunks_offset += ring->nchunks;
+
+		ring->summary_offset = summary_offset;
+		ring->nslots = ring->buffer_size / ITEM_HDR_LEN + 1;
+		ring->firstpos = 0;
+		ring->first_seq = 0;
+		ring->read_seq = 0;
+		ring->next_seq = 0;
+		ring->export_seq = 0;
+		ring->load_seq = 0;
+		ring->shed_level = 0;
+		ring->shed_checked = 0;
+		ring->shed_raised = 0;
+		ring->shed_relaxed = 0;
+		pg_atomic_init_u64(&ring->shed_count, 0);
+		summary_offset += ring->nslots;
 	}
+
+	memset(hdr->chains, 0, sizeof(hdr->chains));
 }
 
 static void
@@ -452,7 +1747,13 @@ pg_logging_shmem_size(int bufsize)
 	shm_toc_initialize_estimator(&e);
 	shm_toc_estimate_chunk(&e, sizeof(LoggingShmemHdr));
 	shm_toc_estimate_chunk(&e, bufsize);
-	shm_toc_estimate_keys(&e, 2);
+	shm_toc_estimate_chunk(&e, sizeof(LogRing) * partitions_setting * MAX_TIERS);
+	shm_toc_estimate_chunk(&e, sizeof(LogChunk) *
+						   MAX_CHUNKS(bufsize, partitions_setting * MAX_TIERS));
+	shm_toc_estimate_chunk(&e, sizeof(ItemSummaryPadded) *
+						   MAX_SUMMARIES(bufsize, partitions_setting * MAX_TIERS) +
+						   PG_CACHE_LINE_SIZE);
+	shm_toc_estimate_keys(&e, 5);
 	size = shm_toc_estimate(&e);
 
 	return size;
@@ -470,14 +1771,46 @@ pg_logging_shmem_hook(void)
 	if (!found)
 	{
 		int tranche_id = LWLockNewTrancheId();
+		int	i;
+		void   *summaries;
 
 		toc = shm_toc_create(PG_LOGGING_MAGIC, addr, segsize);
 
 		hdr = shm_toc_allocate(toc, sizeof(LoggingShmemHdr));
 		hdr->buffer_size = bufsize;
 		hdr->buffer_size_initial = bufsize;
-		hdr->endpos = 0;
-		hdr->readpos = 0;
+		hdr->npartitions = (partition_by_setting == PARTITION_NONE) ? 1 : partitions_setting;
+		hdr->partition_by = partition_by_setting;
+		hdr->ntiers = 1;
+		if (tier_split_setting && *tier_split_setting)
+		{
+			hdr->ntiers = MAX_TIERS;
+			memcpy(hdr->tier_split, tier_split, sizeof(tier_split));
+		}
+		hdr->nrings = hdr->ntiers * hdr->npartitions;
+		hdr->filters_gen = 0;
+		hdr->nfilters = 0;
+		memset(hdr->snapshots, 0, sizeof(hdr->snapshots));
+		memset(hdr->interned, 0, sizeof(hdr->interned));
+		hdr->intern_arena_used = 0;
+
+		hdr->rollup_interval = rollup_interval_setting;
+		for (i = 0; i < ROLLUP_BUCKETS; i++)
+		{
+			RollupBucket   *bucket = &hdr->rollup[i];
+			int				j;
+
+			SpinLockInit(&bucket->mutex);
+			pg_atomic_init_u64(&bucket->interval, 0);
+			pg_atomic_init_u32(&bucket->overflow, 0);
+			for (j = 0; j < ROLLUP_SLOTS; j++)
+			{
+				pg_atomic_init_u64(&bucket->slots[j].key, 0);
+				pg_atomic_init_u32(&bucket->slots[j].count, 0);
+			}
+		}
+		pg_atomic_init_u64(&hdr->export_sent, 0);
+		pg_atomic_init_u64(&hdr->export_dropped, 0);
 
 		/* initialize buffer lwlock */
 #ifdef USE_STATIC_TRANCHE
@@ -492,7 +1825,28 @@ pg_logging_shmem_hook(void)
 		hdr->data = shm_toc_allocate(toc, hdr->buffer_size);
 		shm_toc_insert(toc, 1, hdr->data);
 
+		hdr->rings = shm_toc_allocate(toc, sizeof(LogRing) * hdr->nrings);
+		for (i = 0; i < hdr->nrings; i++)
+			LWLockInitialize(&hdr->rings[i].lock.lock, tranche_id);
+		shm_toc_insert(toc, 2, hdr->rings);
+		hdr->chunks = shm_toc_allocate(toc, sizeof(LogChunk) *
+									   MAX_CHUNKS(hdr->buffer_size, hdr->nrings));
+		shm_toc_insert(toc, 3, hdr->chunks);
+
+		/* summaries should start on a cache line */
+		summaries = shm_toc_allocate(toc, sizeof(ItemSummaryPadded) *
+									 MAX_SUMMARIES(hdr->buffer_size, hdr->nrings) +
+									 PG_CACHE_LINE_SIZE);
+		hdr->summaries = (ItemSummaryPadded *) TYPEALIGN(PG_CACHE_LINE_SIZE,
+														 summaries);
+		shm_toc_insert(toc, 4, summaries);
+		setup_rings(hdr->buffer_size);
+
 		setup_gucs(false);
+
+		/* only postmaster creates the buffer */
+		if (persist_setting)
+			load_rings();
 	}
 	else
 	{
@@ -504,6 +1858,12 @@ pg_logging_shmem_hook(void)
 #endif
 	}
 
+	if (!IsUnderPostmaster)
+	{
+		save_dump_layout();
+		on_shmem_exit(dump_rings, (Datum) 0);
+	}
+
 	shmem_initialized = true;
 
 	if (pg_logging_shmem_hook_next)
@@ -531,10 +1891,19 @@ _PG_init(void)
 	setup_gucs(true);
 	install_hooks();
 
+	if (tier_split_setting && *tier_split_setting)
+		parse_tier_split(tier_split_setting, tier_split);
+
 	bufsize = INTALIGN(buffer_size_setting * 1024);
 	segsize = pg_logging_shmem_size(bufsize);
 
 	RequestAddinShmemSpace(segsize);
+
+	if (export_path_setting && *export_path_setting)
+		register_exporter();
+
+	if (load_database_setting && *load_database_setting)
+		register_loader();
 }
 
 /*
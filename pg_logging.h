@@ -3,7 +3,11 @@
 
 #include "postgres.h"
 #include "pg_config.h"
+#include "port/atomics.h"
+#include "regex/regex.h"
+#include "storage/dsm.h"
 #include "storage/lwlock.h"
+#include "storage/spin.h"
 #include "utils/timestamp.h"
 
 #define CHECK_DATA
@@ -64,31 +68,345 @@ typedef struct CollectedItem
 	int				vxid_len;
 	TransactionId	txid;
 
+	/* object fields */
+	int			object_type;		/* ItemObjectType */
+	int			schema_name_len;
+	int			table_name_len;
+	int			column_name_len;
+	int			datatype_name_len;
+	int			constraint_name_len;
+
+	/* error location, file and function names are interned */
+	int			filename_id;
+	int			lineno;
+	int			funcname_id;
+
+	/* untranslated message format, if pg_logging.store_templates is on */
+	int			template_id;
+	int			flags;
+
+	/* repeats of the item, if pg_logging.collapse_repeats is on */
+	uint32		repeat_count;
+	TimestampTz	last_logtime;
+
 	/* texts are contained here */
 	char		data[FLEXIBLE_ARRAY_MEMBER];
 } CollectedItem;
 
 #define ITEM_HDR_LEN (offsetof(CollectedItem, data))
+#define VXID_BUFSIZE	32		/* longest text of a virtual transaction id */
 
-typedef struct LoggingShmemHdr
+#define MAX_INTERNED		4096
+#define MAX_INTERNED_LEN	1024
+#define INTERN_ARENA_SIZE	(256 * 1024)
+#define INTERN_MAX_PROBES	32
+
+/* item flags */
+#define ITEM_MESSAGE_IS_TEMPLATE	0x01	/* message text is not stored */
+
+#define MAX_FILTERS			16
+#define MAX_FILTER_REGEX	256
+
+/*
+ * Capture filter. Zero (or empty) fields match anything, so a filter with
+ * only database_id set matches every item logged from that database.
+ * SQLSTATE 00000 is zero too, so it's checked only if has_errcode is set.
+ */
+typedef struct LogFilter
 {
-	char			   *data;
+	bool		exclude;		/* drop matched items, otherwise keep only them */
+	Oid			database_id;
+	Oid			user_id;
+	bool		has_errcode;
+	int			sqlerrcode;
+	bool		errclass;		/* compare only SQLSTATE class of sqlerrcode */
+	char		regex[MAX_FILTER_REGEX];	/* pattern for message */
+} LogFilter;
+
+/*
+ * Rings are divided into chunks, for each chunk the position of the first
+ * item started in it is kept (or INVALID_ITEM_POS if an item only passes
+ * through it), so readers could skip chunks without looking to item headers.
+ * Items started in a chunk go one after another, except the chunk of the
+ * oldest item, where the oldest items could follow the newest ones.
+ */
+#define LOG_CHUNK_SIZE		8192
+#define MIN_RING_CHUNKS		8
+#define INVALID_ITEM_POS	((uint32) -1)
+
+typedef struct LogChunk
+{
+	uint32		first;		/* position of the first item in the chunk */
+	uint64		seq;		/* and its number */
+} LogChunk;
+
+/*
+ * Fixed size part of an item. Summaries of each ring are kept in a separate
+ * dense array in order of writing, so scans which need only these fields
+ * go through contiguous memory and don't touch texts of items.
+ */
+typedef struct ItemSummary
+{
+	TimestampTz		logtime;
+	uint64			seq;			/* number of the item in the ring */
+	uint32			pos;			/* item position in the ring */
+	int				totallen;
+	int				elevel;
+	int				ppid;
+	Oid				database_id;
+	Oid				user_id;
+	int				sqlerrcode;
+	TransactionId	txid;
+
+	/* previous item of the same backend */
+	uint64			prev_seq;
+	int				prev_ring;		/* -1 if there is no previous item */
+
+	/* lower bits of seq when texts of the item are copied */
+	volatile uint32	written;
+} ItemSummary;
+
+#define ITEM_SUMMARY_SIZE	64
+
+typedef union ItemSummaryPadded
+{
+	ItemSummary	summary;
+	char		pad[ITEM_SUMMARY_SIZE];
+} ItemSummaryPadded;
+
+/*
+ * Ring buffer. All rings are parts of one data block, each has its own lock
+ * so writers to different rings don't wait for each other.
+ */
+typedef struct LogRing
+{
+	LWLockPadded		lock;
+	uint32				offset;		/* start of the ring in hdr->data */
+	int					buffer_size;
 	volatile uint32		readpos;
 	volatile uint32		endpos;
+	bool				wraparound;
+	uint32				firstpos;		/* the oldest item in the ring */
+
+	/* chunks */
+	uint32				chunk_size;
+	int					nchunks;
+	uint32				chunks_offset;	/* start of the ring in hdr->chunks */
+	int					last_chunk;		/* chunk of the last written item */
+
+	/* summaries, item with number `seq` has slot `seq % nslots` */
+	uint32				summary_offset;	/* start of the ring in hdr->summaries */
+	int					nslots;
+	uint64				first_seq;		/* number of the item at firstpos */
+	uint64				read_seq;		/* number of the item at readpos */
+	uint64				next_seq;		/* number of the next written item */
+	uint64				export_seq;		/* next item for the exporter */
+	uint64				load_seq;		/* next item for the loader */
+
+	/* load shedding, see check_retention */
+	int					shed_level;		/* logs below are shed, or zero */
+	TimestampTz			shed_checked;	/* last check of the horizon */
+	uint64				shed_raised;	/* times shed_level was raised */
+	uint64				shed_relaxed;	/* and lowered */
+	pg_atomic_uint64	shed_count;		/* logs shed */
+} LogRing;
+
+typedef enum PartitionBy {
+	PARTITION_NONE,
+	PARTITION_DATABASE,
+	PARTITION_ROLE
+} PartitionBy;
+
+typedef enum ExportFormat {
+	EXPORT_FORMAT_JSON,
+	EXPORT_FORMAT_BINARY
+} ExportFormat;
+
+typedef enum ExportOverflow {
+	EXPORT_OVERFLOW_DROP,
+	EXPORT_OVERFLOW_PAUSE
+} ExportOverflow;
+
+#define CHAIN_XACTS			8
+
+typedef struct ChainXact
+{
+	TransactionId	txid;		/* invalid if the entry is not used */
+	int				ring;
+	uint64			seq;		/* the latest item of the transaction */
+} ChainXact;
+
+/*
+ * Latest item of a backend, the head of the chain of its items linked by
+ * prev_seq and prev_ring in summaries. Entries are found by pid with linear
+ * probing, a free entry has zero pid. Entries are taken under hdr_lock and
+ * changed only by their backends under the lock of the ring used.
+ */
+typedef struct BackendChain
+{
+	int			pid;
+	int			ring;			/* -1 if the backend has no items yet */
+	uint64		seq;
+
+	/* last transactions of the backend which got ids, in a circle */
+	int			last_xact;
+	ChainXact	xacts[CHAIN_XACTS];
+} BackendChain;
+
+#define MAX_CHAINS			1024
+#define CHAIN_SLOT(pid, i)	( ((uint32) (pid) + (i)) % MAX_CHAINS )
+
+/*
+ * Counters of logs per time interval. Each bucket keeps counts for one
+ * interval in a small hash table by database, level and SQLSTATE class.
+ * Counters are incremented with atomics, the lock of the bucket is taken
+ * only to give it to a new interval.
+ */
+#define ROLLUP_BUCKETS		1440
+#define ROLLUP_SLOTS		32
+
+#define ROLLUP_KEY(dbid, elevel, errclass) \
+	( ((uint64) (dbid) << 32) | ((uint64) (elevel) << 16) | 0x8000 | \
+	  ((errclass) & 0xFFF) )
+#define ROLLUP_KEY_DBID(key)		( (Oid) ((key) >> 32) )
+#define ROLLUP_KEY_ELEVEL(key)		( (int) (((key) >> 16) & 0xFFFF) )
+#define ROLLUP_KEY_ERRCLASS(key)	( (int) ((key) & 0xFFF) )
+
+typedef struct RollupSlot
+{
+	pg_atomic_uint64	key;		/* zero if the slot is free */
+	pg_atomic_uint32	count;
+} RollupSlot;
+
+typedef struct RollupBucket
+{
+	slock_t				mutex;
+	pg_atomic_uint64	interval;	/* number of the interval plus one */
+	pg_atomic_uint32	overflow;	/* counts of keys which didn't fit */
+	RollupSlot			slots[ROLLUP_SLOTS];
+} RollupBucket;
+
+/*
+ * Backend local ring filled by the hook if pg_logging.session_buffer_size is
+ * set. Items are never split: if an item doesn't fit to the end it goes from
+ * the start, and older items end at `tail`.
+ */
+typedef struct SessionRing
+{
+	char	   *data;
+	uint32		size;
+	uint32		first;			/* the oldest item */
+	uint32		end;			/* place for the next item */
+	uint32		tail;			/* end of older items if wrapped */
+	bool		wrapped;
+	bool		reading;		/* don't change while get_my_log reads it */
+	int			nitems;
+	uint32		last;			/* the newest item */
+} SessionRing;
+
+/*
+ * Copy of logs in a DSM segment made by create_log_snapshot. Segments are
+ * pinned, so they stay after the session which made them exits.
+ */
+#define MAX_SNAPSHOTS		8
+
+typedef struct LogSnapshot
+{
+	char		name[NAMEDATALEN];	/* empty if the slot is free */
+	bool		ready;				/* false while the logs are copied */
+	dsm_handle	handle;
+	TimestampTz	created;
+	int			nitems;
+	Size		size;
+} LogSnapshot;
+
+#define MAX_PARTITIONS		128
+#define MAX_TIERS			3	/* debug..info, warning, error..panic */
+
+typedef struct LoggingShmemHdr
+{
+	char			   *data;
+	LogChunk		   *chunks;					/* first items of chunks */
+	ItemSummaryPadded  *summaries;				/* item summaries */
 	int					buffer_size;			/* total size of buffer */
 	int					buffer_size_initial;	/* initial size of buffer */
 	LWLockPadded		hdr_lock;
-	bool				wraparound;
+
+	/*
+	 * rings, one ring for each partition in each tier. Rings of one tier
+	 * go one by one.
+	 */
+	LogRing			   *rings;
+	int					nrings;
+	int					npartitions;
+	int					ntiers;
+	int					tier_split[MAX_TIERS];	/* percents of buffer */
+	int					partition_by;
+
+	/* latest items of backends, changed under the lock of the ring used */
+	BackendChain		chains[MAX_CHAINS];
+
+	/* rollups */
+	int					rollup_interval;		/* in seconds */
+	RollupBucket		rollup[ROLLUP_BUCKETS];
+
+	/* exporter counters, in items */
+	pg_atomic_uint64	export_sent;
+	pg_atomic_uint64	export_dropped;
 
 	/* gucs */
 	bool				logging_enabled;
 	bool				ignore_statements;
 	bool				set_query_fields;
+	bool				store_templates;
+	bool				collapse_repeats;
 	int					minlevel;
+	int					shed_horizon;			/* in seconds */
+	int					shed_sample;
+
+	/* snapshots, protected by hdr_lock */
+	LogSnapshot			snapshots[MAX_SNAPSHOTS];
+
+	/* capture filters, protected by hdr_lock */
+	volatile uint32		filters_gen;	/* incremented on each change */
+	int					nfilters;
+	LogFilter			filters[MAX_FILTERS];
+
+	/*
+	 * Interned strings (source file and function names, message templates).
+	 * Hash table of offsets in intern_arena (plus one), the index in this
+	 * table plus one is used as an id. Entries are added under hdr_lock and
+	 * never changed later, so they could be read without the lock.
+	 */
+	uint32				interned[MAX_INTERNED];
+	uint32				intern_arena_used;
+	char				intern_arena[INTERN_ARENA_SIZE];
 } LoggingShmemHdr;
 
 #define HDR_LOCK() 	( LWLockAcquire(&hdr->hdr_lock.lock, LW_EXCLUSIVE) )
+#define HDR_LOCK_SHARED()	( LWLockAcquire(&hdr->hdr_lock.lock, LW_SHARED) )
 #define HDR_RELEASE() (	LWLockRelease(&hdr->hdr_lock.lock) )
+#define RING_LOCK(ring)		( LWLockAcquire(&(ring)->lock.lock, LW_EXCLUSIVE) )
+#define RING_LOCK_SHARED(ring)	( LWLockAcquire(&(ring)->lock.lock, LW_SHARED) )
+#define RING_RELEASE(ring)	( LWLockRelease(&(ring)->lock.lock) )
+#define RING_DATA(ring)		( hdr->data + (ring)->offset )
+#define RING_CHUNKS(ring)	( hdr->chunks + (ring)->chunks_offset )
+#define RING_CHUNK(ring, pos)	( (pos) / (ring)->chunk_size )
+
+/* distance from one position in the ring to another going forward */
+#define RING_DISTANCE(ring, from, to) \
+	( ((to) + (ring)->buffer_size - (from)) % (ring)->buffer_size )
+
+#define RING_SUMMARY(ring, seq) \
+	( &hdr->summaries[(ring)->summary_offset + (seq) % (ring)->nslots].summary )
+
+/* number of chunks to allocate for the buffer */
+#define MAX_CHUNKS(bufsize, nrings) \
+	( (bufsize) / LOG_CHUNK_SIZE + (nrings) * (MIN_RING_CHUNKS + 2) )
+
+/* number of summaries, enough for the smallest items filling the buffer */
+#define MAX_SUMMARIES(bufsize, nrings) \
+	( (bufsize) / ITEM_HDR_LEN + (nrings) )
 
 struct ErrorLevel {
 	char   *text;
@@ -127,14 +445,80 @@ enum {
 	Anum_pg_logging_query,
 	Anum_pg_logging_query_pos,
 	Anum_pg_logging_position,
+	Anum_pg_logging_object_type,
+	Anum_pg_logging_schema_name,
+	Anum_pg_logging_table_name,
+	Anum_pg_logging_column_name,
+	Anum_pg_logging_datatype_name,
+	Anum_pg_logging_constraint_name,
+	Anum_pg_logging_filename,
+	Anum_pg_logging_lineno,
+	Anum_pg_logging_funcname,
+	Anum_pg_logging_message_template,
+	Anum_pg_logging_repeat_count,
+	Anum_pg_logging_last_logtime,
 
 	Natts_pg_logging_data
 };
 
+// attributes of filter_item type from sql
+enum {
+	Anum_pg_logging_filter_num = 1,
+	Anum_pg_logging_filter_action,
+	Anum_pg_logging_filter_datid,
+	Anum_pg_logging_filter_userid,
+	Anum_pg_logging_filter_errcode,
+	Anum_pg_logging_filter_message,
+
+	Natts_pg_logging_filter
+};
+
+// attributes of rollup_item type from sql
+enum {
+	Anum_pg_logging_rollup_start = 1,
+	Anum_pg_logging_rollup_datid,
+	Anum_pg_logging_rollup_level,
+	Anum_pg_logging_rollup_errclass,
+	Anum_pg_logging_rollup_count,
+
+	Natts_pg_logging_rollup
+};
+
 extern struct ErrorLevel errlevel_wordlist[];
 extern LoggingShmemHdr	*hdr;
 
+extern char *export_path_setting;
+extern int export_format_setting;
+extern int export_batch_size_setting;
+extern int export_interval_setting;
+extern int export_overflow_setting;
+extern int session_buffer_size_setting;
+extern bool persist_setting;
+extern SessionRing session_ring;
+extern char *load_database_setting;
+extern char *load_table_setting;
+extern int load_batch_size_setting;
+extern int load_interval_setting;
+extern int load_retention_setting;
+
+void copy_error_data_to_shmem(ErrorData *edata);
 void reset_counters_in_shmem(int buffer_size);
+void setup_rings(int buffer_size);
+void lock_all_rings(void);
+void release_all_rings(void);
+int get_partition(Oid database_id, Oid user_id);
+LogRing *get_ring(int elevel, Oid database_id, Oid user_id);
 struct ErrorLevel *get_errlevel (register const char *str, register size_t len);
+int compile_filter_regex(const char *pattern, regex_t *re);
+const char *get_interned_string(int id);
+const char *search_bytes(const char *hay, int n, const char *needle, int k);
+void register_exporter(void);
+void register_loader(void);
+void save_dump_layout(void);
+void dump_rings(int code, Datum arg);
+void load_rings(void);
+void fill_values_from(const char *data, uint32 size, uint32 itempos,
+					  Datum *values, bool *isnull);
+void fill_item_values(LogRing *ring, uint32 itempos, Datum *values, bool *isnull);
 
 #endif
@@ -8,6 +8,13 @@
 #include "funcapi.h"
 #include "utils/builtins.h"
 #include "access/htup_details.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "storage/ipc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 
 #if PG_VERSION_NUM >= 110000
 #include "catalog/pg_type_d.h"
@@ -19,21 +26,85 @@
 
 PG_FUNCTION_INFO_V1( get_logged_data_flush );
 PG_FUNCTION_INFO_V1( get_logged_data_from );
+PG_FUNCTION_INFO_V1( get_logged_data_tenant );
+PG_FUNCTION_INFO_V1( get_logged_data_grep );
+PG_FUNCTION_INFO_V1( get_logged_data_tail );
+PG_FUNCTION_INFO_V1( get_logged_data_pid );
+PG_FUNCTION_INFO_V1( get_logged_data_xact );
+PG_FUNCTION_INFO_V1( get_session_logged_data );
+PG_FUNCTION_INFO_V1( get_logged_data_partial );
+PG_FUNCTION_INFO_V1( count_logged_data );
 PG_FUNCTION_INFO_V1( flush_logged_data );
 PG_FUNCTION_INFO_V1( test_ereport );
+PG_FUNCTION_INFO_V1( bench_log_hook );
 PG_FUNCTION_INFO_V1( errlevel_in );
 PG_FUNCTION_INFO_V1( errlevel_out );
 PG_FUNCTION_INFO_V1( errlevel_eq );
+PG_FUNCTION_INFO_V1( add_filter );
+PG_FUNCTION_INFO_V1( clear_filters );
+PG_FUNCTION_INFO_V1( get_filters );
+PG_FUNCTION_INFO_V1( get_rollup );
+PG_FUNCTION_INFO_V1( get_export_stats );
+PG_FUNCTION_INFO_V1( get_shedding_stats );
+PG_FUNCTION_INFO_V1( create_log_snapshot );
+PG_FUNCTION_INFO_V1( get_log_snapshot );
+PG_FUNCTION_INFO_V1( drop_log_snapshot );
+PG_FUNCTION_INFO_V1( get_log_snapshots );
 
 typedef struct {
 	uint32		until;
 	uint32		reading_pos;
+	uint64		seq;			/* number of the item at reading_pos */
 	bool		wraparound;
+} ring_cursor;
+
+/* conditions on item summaries, zero fields match anything */
+typedef struct {
+	int			minlevel;
+	Oid			database_id;
+	Oid			user_id;
+	bool		has_errcode;	/* SQLSTATE 00000 is zero too */
+	int			sqlerrcode;
+	bool		errclass;
+} summary_filter;
+
+typedef struct {
+	int			nrings;
+	LogRing	  **rings;
+	ring_cursor *cursors;
 	bool		flush;
 	int			from;
-	bool		found;
+	bool		tenant_only;
+	Oid			tenant;
+	char	   *pattern;		/* substring to search */
+	int			pattern_len;
+	char	   *crossbuf;		/* for matches crossing the end of a ring */
+	int			tail;			/* number of newest items to return */
+	summary_filter filter;
+	int			pid;			/* backend or transaction to follow */
+	TransactionId txid;
+
+	/* result */
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	MemoryContext batch_mcxt;
+	int			nrows;
 } logged_data_ctx;
 
+typedef struct {
+	TimestampTz	start;
+	uint64		key;			/* zero for logs which didn't fit to slots */
+	uint32		count;
+} rollup_row;
+
+static const char *object_type_names[] = {
+	"none",
+	"table",
+	"column",
+	"datatype",
+	"constraint"
+};
+
 static char *
 get_errlevel_name(int code)
 {
@@ -47,16 +118,30 @@ get_errlevel_name(int code)
 	elog(ERROR, "Invalid error level name");
 }
 
+void
+lock_all_rings(void)
+{
+	int		i;
+
+	for (i = 0; i < hdr->nrings; i++)
+		RING_LOCK(&hdr->rings[i]);
+}
+
+void
+release_all_rings(void)
+{
+	int		i;
+
+	for (i = hdr->nrings - 1; i >= 0; i--)
+		RING_RELEASE(&hdr->rings[i]);
+}
+
 void
 reset_counters_in_shmem(int buffer_size)
 {
-	HDR_LOCK();
-	hdr->endpos = 0;
-	hdr->readpos = 0;
-	hdr->wraparound = false;
-	if (buffer_size > 0)
-		hdr->buffer_size = buffer_size;
-	HDR_RELEASE();
+	lock_all_rings();
+	setup_rings(buffer_size > 0 ? buffer_size : hdr->buffer_size);
+	release_all_rings();
 }
 
 Datum
@@ -66,280 +151,2065 @@ flush_logged_data(PG_FUNCTION_ARGS)
 	PG_RETURN_VOID();
 }
 
+#define LOG_BATCH_SIZE		256
+
 enum call_type
 {
 	ct_flush,
-	ct_from
+	ct_from,
+	ct_tenant,
+	ct_grep,
+	ct_tail,
+	ct_pid,
+	ct_xact
 };
 
-static Datum
-get_logged_data(PG_FUNCTION_ARGS, enum call_type ctype)
+static void parse_summary_filter(FunctionCallInfo fcinfo, int argno,
+								 summary_filter *filter);
+
+static void
+lock_rings(logged_data_ctx *usercxt, LWLockMode mode)
 {
-	MemoryContext		old_mcxt;
-	FuncCallContext	   *funccxt;
-	logged_data_ctx	   *usercxt;
+	int		i;
 
-	if (SRF_IS_FIRSTCALL())
-	{
-		TupleDesc	tupdesc;
+	for (i = 0; i < usercxt->nrings; i++)
+		LWLockAcquire(&usercxt->rings[i]->lock.lock, mode);
+}
 
-		funccxt = SRF_FIRSTCALL_INIT();
+static void
+release_rings(logged_data_ctx *usercxt)
+{
+	int		i;
 
-		old_mcxt = MemoryContextSwitchTo(funccxt->multi_call_memory_ctx);
+	for (i = usercxt->nrings - 1; i >= 0; i--)
+		RING_RELEASE(usercxt->rings[i]);
+}
 
-		HDR_LOCK();
-		usercxt = (logged_data_ctx *) palloc(sizeof(logged_data_ctx));
-		usercxt->until = hdr->endpos;
-		usercxt->reading_pos = hdr->readpos;
-		usercxt->wraparound = hdr->wraparound;
-		usercxt->flush = false;
-		usercxt->from = -1;
-
-		switch (ctype)
+/*
+ * Sets the reading position of the ring to the cursor. The ring could be
+ * written since the cursor was taken, so the item could be evicted already.
+ */
+static void
+move_read_position(LogRing *ring, ring_cursor *cur)
+{
+	if (cur->seq < ring->first_seq)
+	{
+		ring->readpos = ring->firstpos;
+		ring->read_seq = ring->first_seq;
+	}
+	else
+	{
+		ring->readpos = cur->reading_pos;
+		ring->read_seq = cur->seq;
+	}
+	ring->wraparound = ring->readpos > ring->endpos;
+}
+
+/* Returns false if there is nothing left to read in the ring */
+static bool
+ring_cursor_valid(LogRing *ring, ring_cursor *cur)
+{
+	while ((!cur->wraparound && cur->reading_pos < cur->until) ||
+			(cur->wraparound && cur->reading_pos > cur->until))
+	{
+		if (cur->reading_pos + ITEM_HDR_LEN > ring->buffer_size)
 		{
-			case ct_flush:
-				usercxt->flush = PG_GETARG_BOOL(0);
-				break;
-			case ct_from:
-				usercxt->from = PG_GETARG_INT32(0);
-				break;
+			cur->reading_pos = 0;
+			cur->wraparound = false;
+			continue;
 		}
-		usercxt->found = false;
+		return true;
+	}
 
-		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-			elog(ERROR, "return type must be a row type");
+	return false;
+}
 
-		funccxt->tuple_desc = BlessTupleDesc(tupdesc);
-		funccxt->user_fctx = (void *) usercxt;
+static void
+ring_cursor_next(LogRing *ring, ring_cursor *cur, int totallen)
+{
+	cur->seq++;
+	if (cur->reading_pos + totallen >= ring->buffer_size)
+	{
+		/* two parts */
+		cur->wraparound = false;
+		cur->reading_pos += totallen;
+		cur->reading_pos = cur->reading_pos - ring->buffer_size;
+	}
+	else
+	{
+		/* one part */
+		cur->reading_pos += totallen;
+	}
+}
 
-		MemoryContextSwitchTo(old_mcxt);
+/* Checks that the item at `pos` is not read by the cursor yet */
+static bool
+ring_cursor_ahead(LogRing *ring, ring_cursor *cur, uint32 pos)
+{
+	return RING_DISTANCE(ring, cur->reading_pos, pos) <
+		RING_DISTANCE(ring, cur->reading_pos, cur->until);
+}
+
+static void
+ring_cursor_set(ring_cursor *cur, uint32 pos, uint64 seq)
+{
+	cur->wraparound = pos > cur->until;
+	cur->reading_pos = pos;
+	cur->seq = seq;
+}
+
+/*
+ * Moves the cursor to the item at `pos`. The walk starts from the first item
+ * of the chunk, so only items of one chunk are looked through. Returns false
+ * if there is no item at this position.
+ */
+static bool
+ring_cursor_seek(LogRing *ring, ring_cursor *cur, uint32 pos)
+{
+	LogChunk   *chunk;
+	uint32		p;
+	uint64		seq;
+
+	if (!ring_cursor_valid(ring, cur) ||
+			!(pos == cur->reading_pos || ring_cursor_ahead(ring, cur, pos)))
+		return false;
+
+	chunk = &RING_CHUNKS(ring)[RING_CHUNK(ring, pos)];
+	p = chunk->first;
+	seq = chunk->seq;
+	if (RING_CHUNK(ring, ring->firstpos) == RING_CHUNK(ring, pos) &&
+			ring->firstpos <= pos &&
+			(p == INVALID_ITEM_POS || p < ring->firstpos))
+	{
+		/* the oldest items follow the newest ones in this chunk */
+		p = ring->firstpos;
+		seq = ring->first_seq;
+	}
+	if (RING_CHUNK(ring, cur->reading_pos) == RING_CHUNK(ring, pos) &&
+			cur->reading_pos <= pos &&
+			(p == INVALID_ITEM_POS || p < cur->reading_pos))
+	{
+		/* the first item of the chunk was read */
+		p = cur->reading_pos;
+		seq = cur->seq;
 	}
 
-	funccxt = SRF_PERCALL_SETUP();
-	usercxt = (logged_data_ctx *) funccxt->user_fctx;
+	if (p == INVALID_ITEM_POS || p > pos)
+		return false;
 
-	pg_read_barrier();
+	while (p < pos)
+	{
+		p += RING_SUMMARY(ring, seq)->totallen;
+		seq++;
+	}
+
+	if (p != pos)
+		return false;
+
+	ring_cursor_set(cur, pos, seq);
+	return true;
+}
+
+/*
+ * Skips items older than `logtime` (or equal if `inclusive`). Whole chunks
+ * are skipped while their first items are older, then the rest is walked
+ * item by item.
+ */
+static void
+ring_cursor_skip_older(LogRing *ring, ring_cursor *cur, TimestampTz logtime,
+					   bool inclusive)
+{
+	LogChunk   *chunks = RING_CHUNKS(ring);
+	int			c;
+
+#define ITEM_IS_OLDER(seq) \
+	(RING_SUMMARY(ring, seq)->logtime < logtime || \
+	 (inclusive && RING_SUMMARY(ring, seq)->logtime == logtime))
+
+	if (!ring_cursor_valid(ring, cur))
+		return;
 
-	while ((!usercxt->wraparound && usercxt->reading_pos < usercxt->until) ||
-			(usercxt->wraparound && usercxt->reading_pos > usercxt->until))
+	c = RING_CHUNK(ring, cur->reading_pos);
+	for (;;)
 	{
-		CollectedItem  *item;
-		char		   *data;
-		HeapTuple		htup;
-		Datum			values[Natts_pg_logging_data];
-		bool			isnull[Natts_pg_logging_data];
-		bool			skip = false;
-		int				curpos;
+		c = (c + 1) % ring->nchunks;
+		if (c == RING_CHUNK(ring, cur->reading_pos))
+			break;
 
-		if (usercxt->reading_pos + ITEM_HDR_LEN > hdr->buffer_size)
-		{
-			usercxt->reading_pos = 0;
-			usercxt->wraparound = false;
+		if (chunks[c].first == INVALID_ITEM_POS)
 			continue;
-		}
 
-		if (usercxt->from > 0)
-		{
-			if (usercxt->reading_pos != usercxt->from)
-				skip = true;
-			else
-			{
-				usercxt->found = true;
-				usercxt->from = -1;
+		if (!ring_cursor_ahead(ring, cur, chunks[c].first) ||
+				!ITEM_IS_OLDER(chunks[c].seq))
+			break;
 
-				/* next time this position will be first */
-				hdr->readpos = usercxt->reading_pos;
-				hdr->wraparound = usercxt->wraparound;
-			}
-		}
+		ring_cursor_set(cur, chunks[c].first, chunks[c].seq);
+	}
+
+	while (ring_cursor_valid(ring, cur) && ITEM_IS_OLDER(cur->seq))
+		ring_cursor_next(ring, cur, RING_SUMMARY(ring, cur->seq)->totallen);
+
+#undef ITEM_IS_OLDER
+}
 
-		data = (char *) (hdr->data + usercxt->reading_pos);
-		curpos = usercxt->reading_pos;
-		AssertPointerAlignment(data, 4);
+/*
+ * Positions cursors so reading starts from the item with `from` position,
+ * items of other rings which are older than it are skipped.
+ */
+static bool
+seek_from_position(logged_data_ctx *usercxt)
+{
+	TimestampTz	logtime;
+	int			found = -1;
+	int			i;
 
-		/*
-		 * careful here, we point to the buffer first, then allocate a
-		 * block using information from buffer
-		 */
-		item = (CollectedItem *) data;
-		Assert(item->totallen < hdr->buffer_size);
+	for (i = 0; i < usercxt->nrings; i++)
+	{
+		LogRing *ring = usercxt->rings[i];
 
-		/* Make calculations like below but without copying */
-		if (skip)
+		if (usercxt->from >= ring->offset &&
+				usercxt->from < ring->offset + ring->buffer_size)
 		{
-			if (usercxt->reading_pos + item->totallen >= hdr->buffer_size)
-			{
-				/* two parts */
-				usercxt->wraparound = false;
-				usercxt->reading_pos += item->totallen;
-				usercxt->reading_pos = usercxt->reading_pos - hdr->buffer_size;
-			}
-			else
-			{
-				/* one part */
-				usercxt->reading_pos += item->totallen;
-			}
+			if (!ring_cursor_seek(ring, &usercxt->cursors[i],
+								  usercxt->from - ring->offset))
+				return false;
 
-			continue;
+			found = i;
+			break;
 		}
+	}
 
-		item = (CollectedItem *) palloc0(item->totallen);
-		memcpy(item, data, offsetof(CollectedItem, data));
-		data += ITEM_HDR_LEN;
+	if (found < 0)
+		return false;
 
-		if (usercxt->reading_pos + item->totallen >= hdr->buffer_size)
-		{
-			/* two parts */
-			int	taillen = hdr->buffer_size - usercxt->reading_pos - ITEM_HDR_LEN;
-			memcpy(item->data, data, taillen);
-			usercxt->wraparound = false;
-			usercxt->reading_pos += item->totallen;
-			usercxt->reading_pos = usercxt->reading_pos - hdr->buffer_size;
-			memcpy(item->data + taillen, hdr->data, usercxt->reading_pos);
-		}
-		else
-		{
-			/* one part */
-			memcpy(item->data, data, item->totallen - ITEM_HDR_LEN);
-			usercxt->reading_pos += item->totallen;
-		}
+	logtime = RING_SUMMARY(usercxt->rings[found],
+						   usercxt->cursors[found].seq)->logtime;
 
-		MemSet(values, 0, sizeof(values));
-		MemSet(isnull, 0, sizeof(isnull));
+	/* rings go in order of preference for items with the same time */
+	for (i = 0; i < usercxt->nrings; i++)
+	{
+		if (i != found)
+			ring_cursor_skip_older(usercxt->rings[i], &usercxt->cursors[i],
+								   logtime, i < found);
+	}
 
-		values[Anum_pg_logging_logtime - 1] = TimestampTzGetDatum(item->logtime);
+	return true;
+}
 
-		if (item->session_start_time)
-			values[Anum_pg_logging_start_time - 1] = TimestampTzGetDatum(item->session_start_time);
-		else
-			isnull[Anum_pg_logging_start_time - 1] = true;
-
-		values[Anum_pg_logging_level - 1] = Int32GetDatum(item->elevel);
-		values[Anum_pg_logging_errno - 1] = Int32GetDatum(item->saved_errno);
-		values[Anum_pg_logging_errcode - 1] = Int32GetDatum(item->sqlerrcode);
-		values[Anum_pg_logging_datid - 1] = Int32GetDatum(item->database_id);
-		values[Anum_pg_logging_pid - 1] = Int32GetDatum(item->ppid);
-		values[Anum_pg_logging_line_num - 1] = Int64GetDatum(item->log_line_number);
-		values[Anum_pg_logging_internalpos - 1] = Int32GetDatum(item->internalpos);
-		values[Anum_pg_logging_query_pos - 1] = Int32GetDatum(item->query_pos);
-		values[Anum_pg_logging_position - 1] = Int32GetDatum(curpos);
-
-		if (TransactionIdIsValid(item->txid))
-			values[Anum_pg_logging_txid - 1] = TransactionIdGetDatum(item->txid);
-		else
-			isnull[Anum_pg_logging_txid - 1] = true;
+/*
+ * Search the pattern in a text of the item right in the ring. The text could
+ * be split by the end of the ring, then its parts are searched separately and
+ * bytes around the end are copied to check matches crossing it.
+ */
+static bool
+ring_text_contains(LogRing *ring, uint32 pos, int len, logged_data_ctx *usercxt)
+{
+	char   *ringdata = RING_DATA(ring);
+	int		k = usercxt->pattern_len;
+	int		part1;
 
-		if (OidIsValid(item->user_id))
-			values[Anum_pg_logging_userid - 1] = ObjectIdGetDatum(item->user_id);
-		else
-			isnull[Anum_pg_logging_userid - 1] = true;
+	if (len < k)
+		return false;
+
+	if (pos >= ring->buffer_size)
+		pos -= ring->buffer_size;
+
+	part1 = Min(len, ring->buffer_size - pos);
+	if (search_bytes(ringdata + pos, part1, usercxt->pattern, k))
+		return true;
+
+	if (part1 == len)
+		return false;
+
+	if (k > 1)
+	{
+		int		before = Min(part1, k - 1),
+				after = Min(len - part1, k - 1);
+
+		memcpy(usercxt->crossbuf, ringdata + pos + part1 - before, before);
+		memcpy(usercxt->crossbuf + before, ringdata, after);
+		if (search_bytes(usercxt->crossbuf, before + after, usercxt->pattern, k))
+			return true;
+	}
+
+	return search_bytes(ringdata, len - part1, usercxt->pattern, k) != NULL;
+}
+
+/* Checks message, detail and query of the item without copying it */
+static bool
+item_contains(LogRing *ring, uint32 pos, CollectedItem *item,
+			  logged_data_ctx *usercxt)
+{
+	uint32	query_pos;
+
+	pos += ITEM_HDR_LEN;
+	if (item->flags & ITEM_MESSAGE_IS_TEMPLATE)
+	{
+		const char *msg = get_interned_string(item->template_id);
+
+		if (search_bytes(msg, strlen(msg), usercxt->pattern, usercxt->pattern_len))
+			return true;
+	}
+	else if (ring_text_contains(ring, pos, item->message_len, usercxt))
+		return true;
+
+	if (ring_text_contains(ring, pos + item->message_len, item->detail_len, usercxt))
+		return true;
+
+	/* ordering is important, look pg_logging.c !! */
+	query_pos = pos + item->message_len + item->detail_len + item->detail_log_len +
+		item->hint_len + item->context_len + item->domain_len +
+		item->context_domain_len + item->internalquery_len + item->errstate_len +
+		item->appname_len + item->remote_host_len + item->command_tag_len +
+		item->vxid_len;
+
+	return ring_text_contains(ring, query_pos, item->query_len, usercxt);
+}
+
+/* Makes text datum from the ring, the text could be split by the end */
+static Datum
+ring_text_datum(const char *data, uint32 size, uint32 pos, int len)
+{
+	text   *res = (text *) palloc(len + VARHDRSZ);
+	int		part1;
+
+	if (pos >= size)
+		pos -= size;
+
+	part1 = Min(len, size - pos);
+	SET_VARSIZE(res, len + VARHDRSZ);
+	memcpy(VARDATA(res), data + pos, part1);
+	memcpy(VARDATA(res) + part1, data, len - part1);
+
+	return PointerGetDatum(res);
+}
+
+/*
+ * Fill values of log_item from the item located at `itempos` in a ring
+ * of `size` bytes starting at `data`, the position is left null. Texts
+ * are built right from the ring without copying the whole item.
+ */
+void
+fill_values_from(const char *data, uint32 size, uint32 itempos,
+				 Datum *values, bool *isnull)
+{
+	CollectedItem  *item = (CollectedItem *) (data + itempos);
+	uint32			pos = itempos + ITEM_HDR_LEN;
+
+	AssertPointerAlignment(item, 4);
+	Assert(item->totallen <= size);
+
+	MemSet(values, 0, sizeof(Datum) * Natts_pg_logging_data);
+	MemSet(isnull, 0, sizeof(bool) * Natts_pg_logging_data);
+
+	values[Anum_pg_logging_logtime - 1] = TimestampTzGetDatum(item->logtime);
+
+	if (item->session_start_time)
+		values[Anum_pg_logging_start_time - 1] = TimestampTzGetDatum(item->session_start_time);
+	else
+		isnull[Anum_pg_logging_start_time - 1] = true;
+
+	values[Anum_pg_logging_level - 1] = Int32GetDatum(item->elevel);
+	values[Anum_pg_logging_errno - 1] = Int32GetDatum(item->saved_errno);
+	values[Anum_pg_logging_errcode - 1] = Int32GetDatum(item->sqlerrcode);
+	values[Anum_pg_logging_datid - 1] = Int32GetDatum(item->database_id);
+	values[Anum_pg_logging_pid - 1] = Int32GetDatum(item->ppid);
+	values[Anum_pg_logging_line_num - 1] = Int64GetDatum(item->log_line_number);
+	values[Anum_pg_logging_internalpos - 1] = Int32GetDatum(item->internalpos);
+	values[Anum_pg_logging_query_pos - 1] = Int32GetDatum(item->query_pos);
+	isnull[Anum_pg_logging_position - 1] = true;
+
+	if (TransactionIdIsValid(item->txid))
+		values[Anum_pg_logging_txid - 1] = TransactionIdGetDatum(item->txid);
+	else
+		isnull[Anum_pg_logging_txid - 1] = true;
+
+	if (OidIsValid(item->user_id))
+		values[Anum_pg_logging_userid - 1] = ObjectIdGetDatum(item->user_id);
+	else
+		isnull[Anum_pg_logging_userid - 1] = true;
 
-		data = item->data;
 #define	EXTRACT_VAL_TO(attnum, len)								\
 do {															\
 	if (len) {													\
-		text *ct = cstring_to_text_with_len(data, len);			\
-		values[(attnum) - 1] = PointerGetDatum(ct);				\
-		data += (len);											\
+		values[(attnum) - 1] = ring_text_datum(data, size, pos, len);	\
+		pos += (len);											\
 	}															\
 	else isnull[(attnum) - 1] = true;							\
 } while (0);
 
-		/* ordering is important, look pg_logging.c !! */
-		EXTRACT_VAL_TO(Anum_pg_logging_message, item->message_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_detail, item->detail_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_detail_log, item->detail_log_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_hint, item->hint_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_context, item->context_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_domain, item->domain_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_context_domain, item->context_domain_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_internalquery, item->internalquery_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_errstate, item->errstate_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_appname, item->appname_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_remote_host, item->remote_host_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_command_tag, item->command_tag_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_vxid, item->vxid_len);
-		EXTRACT_VAL_TO(Anum_pg_logging_query, item->query_len);
-
-		/* form output tuple */
-		htup = heap_form_tuple(funccxt->tuple_desc, values, isnull);
-		pfree(item);
+	/* ordering is important, look pg_logging.c !! */
+	EXTRACT_VAL_TO(Anum_pg_logging_message, item->message_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_detail, item->detail_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_detail_log, item->detail_log_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_hint, item->hint_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_context, item->context_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_domain, item->domain_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_context_domain, item->context_domain_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_internalquery, item->internalquery_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_errstate, item->errstate_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_appname, item->appname_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_remote_host, item->remote_host_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_command_tag, item->command_tag_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_vxid, item->vxid_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_query, item->query_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_schema_name, item->schema_name_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_table_name, item->table_name_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_column_name, item->column_name_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_datatype_name, item->datatype_name_len);
+	EXTRACT_VAL_TO(Anum_pg_logging_constraint_name, item->constraint_name_len);
 
-		SRF_RETURN_NEXT(funccxt, HeapTupleGetDatum(htup));
-	}
+	if (item->object_type != IOT_NONE)
+		values[Anum_pg_logging_object_type - 1] =
+			CStringGetTextDatum(object_type_names[item->object_type]);
+	else
+		isnull[Anum_pg_logging_object_type - 1] = true;
 
-	if (ctype == ct_from && !usercxt->found)
+	if (item->filename_id)
 	{
-		HDR_RELEASE();
-		elog(ERROR, "nothing with specified position was found");
+		values[Anum_pg_logging_filename - 1] =
+			CStringGetTextDatum(get_interned_string(item->filename_id));
+		values[Anum_pg_logging_lineno - 1] = Int32GetDatum(item->lineno);
+	}
+	else
+	{
+		isnull[Anum_pg_logging_filename - 1] = true;
+		isnull[Anum_pg_logging_lineno - 1] = true;
 	}
 
-	if (usercxt->flush)
+	if (item->funcname_id)
+		values[Anum_pg_logging_funcname - 1] =
+			CStringGetTextDatum(get_interned_string(item->funcname_id));
+	else
+		isnull[Anum_pg_logging_funcname - 1] = true;
+
+	if (item->template_id)
 	{
-		hdr->readpos = usercxt->reading_pos;
-		hdr->wraparound = false;
+		Datum	tmpl = CStringGetTextDatum(get_interned_string(item->template_id));
+
+		values[Anum_pg_logging_message_template - 1] = tmpl;
+		if (item->flags & ITEM_MESSAGE_IS_TEMPLATE)
+		{
+			values[Anum_pg_logging_message - 1] = tmpl;
+			isnull[Anum_pg_logging_message - 1] = false;
+		}
 	}
+	else
+		isnull[Anum_pg_logging_message_template - 1] = true;
 
-	HDR_RELEASE();
-	SRF_RETURN_DONE(funccxt);
+	values[Anum_pg_logging_repeat_count - 1] = Int32GetDatum(item->repeat_count);
+	if (item->repeat_count > 0)
+		values[Anum_pg_logging_last_logtime - 1] = TimestampTzGetDatum(item->last_logtime);
+	else
+		isnull[Anum_pg_logging_last_logtime - 1] = true;
 }
 
-Datum
-get_logged_data_flush(PG_FUNCTION_ARGS)
+/* Fill values of log_item from the item located in the ring at `itempos` */
+void
+fill_item_values(LogRing *ring, uint32 itempos, Datum *values, bool *isnull)
 {
-	return get_logged_data(fcinfo, ct_flush);
+	fill_values_from(RING_DATA(ring), ring->buffer_size, itempos, values, isnull);
+	values[Anum_pg_logging_position - 1] = Int32GetDatum(ring->offset + itempos);
+	isnull[Anum_pg_logging_position - 1] = false;
 }
 
-Datum
-get_logged_data_from(PG_FUNCTION_ARGS)
+/*
+ * Checks that the item is completely written. Space for an item is reserved
+ * under the ring lock, but the writer copies it after the lock is released,
+ * so texts (and the header) of the item could be read only after this.
+ */
+static bool
+item_is_written(ItemSummary *summary, uint64 seq)
 {
-	return get_logged_data(fcinfo, ct_from);
+	if (summary->written != (uint32) seq)
+		return false;
+
+	pg_read_barrier();
+	return true;
 }
 
-Datum
-test_ereport(PG_FUNCTION_ARGS)
+static bool
+summary_matches(ItemSummary *summary, summary_filter *filter)
 {
-	ereport(PG_GETARG_INT32(0),
-			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-			 errmsg("%s", PG_GETARG_CSTRING(1)),
-			 errdetail("%s", PG_GETARG_CSTRING(2)),
-			 errhint("%s", PG_GETARG_CSTRING(3))));
-	PG_RETURN_VOID();
+	if (summary->elevel < filter->minlevel)
+		return false;
+	if (filter->database_id && summary->database_id != filter->database_id)
+		return false;
+	if (filter->user_id && summary->user_id != filter->user_id)
+		return false;
+	if (filter->has_errcode && (filter->errclass ?
+			ERRCODE_TO_CATEGORY(summary->sqlerrcode) :
+			summary->sqlerrcode) != filter->sqlerrcode)
+		return false;
+
+	return true;
 }
 
-Datum
-errlevel_out(PG_FUNCTION_ARGS)
+/*
+ * Adds the item to the result. Texts are allocated in a small context which
+ * is reset after each batch of rows, so large reads run in bounded memory.
+ */
+static void
+put_item(logged_data_ctx *usercxt, LogRing *ring, uint32 pos)
 {
-	PG_RETURN_CSTRING(get_errlevel_name(PG_GETARG_INT32(0)));
+	Datum			values[Natts_pg_logging_data];
+	bool			isnull[Natts_pg_logging_data];
+	MemoryContext	old_mcxt;
+
+	old_mcxt = MemoryContextSwitchTo(usercxt->batch_mcxt);
+	fill_item_values(ring, pos, values, isnull);
+	tuplestore_putvalues(usercxt->tupstore, usercxt->tupdesc, values, isnull);
+	MemoryContextSwitchTo(old_mcxt);
+
+	if (++usercxt->nrows % LOG_BATCH_SIZE == 0)
+		MemoryContextReset(usercxt->batch_mcxt);
 }
 
-static char *
-lowerstr(char *str)
+/*
+ * Puts items to the result going forward from reading positions of the
+ * rings, the oldest first.
+ */
+static void
+put_items(logged_data_ctx *usercxt)
 {
 	int		i;
-	char   *res = pstrdup(str);
 
-	for (i = 0; str[i]; i++)
+	for (;;)
 	{
-		res[i] = tolower(str[i]);
-	}
+		LogRing		   *ring = NULL;
+		ring_cursor	   *cur = NULL;
+		ItemSummary	   *summary = NULL;
+		bool			skip = false;
 
-	return res;
+		/* take the oldest item between rings, only summaries are needed */
+		for (i = 0; i < usercxt->nrings; i++)
+		{
+			LogRing		   *r = usercxt->rings[i];
+			ring_cursor	   *c = &usercxt->cursors[i];
+			ItemSummary	   *s;
+
+			if (!ring_cursor_valid(r, c))
+				continue;
+
+			s = RING_SUMMARY(r, c->seq);
+			if (!item_is_written(s, c->seq))
+			{
+				/* the item is being written, read the ring only up to it */
+				c->until = c->reading_pos;
+				c->wraparound = false;
+				continue;
+			}
+
+			if (summary == NULL || s->logtime < summary->logtime)
+			{
+				ring = r;
+				cur = c;
+				summary = s;
+			}
+		}
+
+		if (summary == NULL)
+			break;
+
+		Assert(summary->pos == cur->reading_pos);
+
+		if (usercxt->tenant_only)
+		{
+			Oid		tenant = (hdr->partition_by == PARTITION_DATABASE) ?
+								summary->database_id : summary->user_id;
+
+			if (tenant != usercxt->tenant)
+				skip = true;
+		}
+
+		if (!skip && usercxt->pattern &&
+				!item_contains(ring, cur->reading_pos,
+							   (CollectedItem *) (RING_DATA(ring) + cur->reading_pos),
+							   usercxt))
+			skip = true;
+
+		if (!skip)
+			put_item(usercxt, ring, cur->reading_pos);
+
+		ring_cursor_next(ring, cur, summary->totallen);
+	}
 }
 
-Datum
-errlevel_in(PG_FUNCTION_ARGS)
+/*
+ * Puts newest matching items to the tuplestore, newest first. Summaries are
+ * walked backwards from the end of each ring, so only items newer than the
+ * last returned one are looked at.
+ */
+static void
+put_tail_items(logged_data_ctx *usercxt)
 {
-	char   *str = lowerstr(PG_GETARG_CSTRING(0));
-	int		len = strlen(str);
-	struct ErrorLevel *el;
+	uint64	   *seqs = palloc(sizeof(uint64) * usercxt->nrings);
+	int			i;
 
-	if (len == 0)
-		elog(ERROR, "Empty status name");
+	for (i = 0; i < usercxt->nrings; i++)
+		seqs[i] = usercxt->rings[i]->next_seq;
 
-	el = get_errlevel(str, len);
-	if (!el)
-		elog(ERROR, "Unknown level name: %s", str);
+	while (usercxt->nrows < usercxt->tail)
+	{
+		LogRing		   *ring = NULL;
+		ItemSummary	   *summary = NULL;
+		int				found = -1;
 
-	PG_RETURN_INT32(el->code);
+		/* take the newest item, in reverse order of get_log for same times */
+		for (i = usercxt->nrings - 1; i >= 0; i--)
+		{
+			LogRing		   *r = usercxt->rings[i];
+			ItemSummary	   *s;
+
+			if (seqs[i] == r->read_seq)
+				continue;
+
+			s = RING_SUMMARY(r, seqs[i] - 1);
+			if (summary == NULL || s->logtime > summary->logtime)
+			{
+				ring = r;
+				summary = s;
+				found = i;
+			}
+		}
+
+		if (summary == NULL)
+			break;
+
+		seqs[found]--;
+		if (item_is_written(summary, seqs[found]) &&
+				summary_matches(summary, &usercxt->filter))
+			put_item(usercxt, ring, summary->pos);
+	}
+
+	pfree(seqs);
+}
+
+/* Returns summary of an item from a backend chain if it's still there */
+static ItemSummary *
+chain_item(int ringno, uint64 seq, int pid)
+{
+	LogRing		   *ring;
+	ItemSummary	   *summary;
+
+	if (ringno < 0 || ringno >= hdr->nrings)
+		return NULL;
+
+	ring = &hdr->rings[ringno];
+	if (seq < ring->read_seq || seq >= ring->next_seq)
+		return NULL;
+
+	summary = RING_SUMMARY(ring, seq);
+	if (summary->seq != seq || summary->ppid != pid)
+		return NULL;
+
+	return summary;
+}
+
+/*
+ * Finds the newest item of the transaction among the last transactions
+ * of backends, so only recent transactions of each backend are found.
+ */
+static bool
+find_xact_item(TransactionId txid, int *ringno, uint64 *seq)
+{
+	int		i,
+			j;
+
+	for (i = 0; i < MAX_CHAINS; i++)
+	{
+		BackendChain   *chain = &hdr->chains[i];
+
+		if (chain->pid == 0)
+			continue;
+
+		for (j = 0; j < CHAIN_XACTS; j++)
+		{
+			if (chain->xacts[j].txid == txid)
+			{
+				*ringno = chain->xacts[j].ring;
+				*seq = chain->xacts[j].seq;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Copies virtual transaction id of the item to `buf` and returns its length.
+ * The buffer should fit VXID_BUFSIZE bytes.
+ */
+static int
+item_vxid(LogRing *ring, uint32 itempos, char *buf)
+{
+	CollectedItem  *item = (CollectedItem *) (RING_DATA(ring) + itempos);
+	uint32			pos;
+	int				len,
+					part1;
+
+	/* ordering is important, look pg_logging.c !! */
+	pos = itempos + ITEM_HDR_LEN + item->message_len + item->detail_len +
+		item->detail_log_len + item->hint_len + item->context_len +
+		item->domain_len + item->context_domain_len + item->internalquery_len +
+		item->errstate_len + item->appname_len + item->remote_host_len +
+		item->command_tag_len;
+	pos %= ring->buffer_size;
+
+	len = Min(item->vxid_len, VXID_BUFSIZE);
+	part1 = Min(len, ring->buffer_size - pos);
+	memcpy(buf, RING_DATA(ring) + pos, part1);
+	memcpy(buf + part1, RING_DATA(ring), len - part1);
+
+	return len;
+}
+
+/*
+ * Puts items of one backend (or one transaction) to the result, following
+ * the chain of backend items backwards from the latest one. The chain ends
+ * on an item which was evicted or flushed. For transactions the walk stops
+ * on the first item of another transaction. Items logged before the
+ * transaction got its id have no txid, they are taken while their virtual
+ * transaction id is the same.
+ */
+static void
+put_chain_items(logged_data_ctx *usercxt)
+{
+	ItemSummary	   *summary = NULL;
+	LogRing		  **rings;
+	uint32		   *positions;
+	int				count = 0,
+					size = 64;
+	int				ringno = -1;
+	uint64			seq = 0;
+	char			xact_vxid[VXID_BUFSIZE],
+					vxid[VXID_BUFSIZE];
+	int				xact_vxid_len = -1;
+	int				i;
+
+	if (usercxt->txid != InvalidTransactionId)
+	{
+		if (find_xact_item(usercxt->txid, &ringno, &seq))
+			usercxt->pid = RING_SUMMARY(&hdr->rings[ringno], seq)->ppid;
+	}
+	else
+	{
+		for (i = 0; i < MAX_CHAINS && usercxt->pid > 0; i++)
+		{
+			BackendChain   *chain = &hdr->chains[CHAIN_SLOT(usercxt->pid, i)];
+
+			if (chain->pid == 0)
+				break;
+
+			if (chain->pid == usercxt->pid)
+			{
+				ringno = chain->ring;
+				seq = chain->seq;
+				break;
+			}
+		}
+	}
+
+	rings = palloc(sizeof(LogRing *) * size);
+	positions = palloc(sizeof(uint32) * size);
+	while ((summary = chain_item(ringno, seq, usercxt->pid)) != NULL)
+	{
+		bool	written = item_is_written(summary, seq);
+
+		if (usercxt->txid != InvalidTransactionId)
+		{
+			if (summary->txid == usercxt->txid)
+			{
+				if (xact_vxid_len < 0 && written)
+					xact_vxid_len = item_vxid(&hdr->rings[ringno], summary->pos,
+											  xact_vxid);
+			}
+			else if (summary->txid != InvalidTransactionId)
+				break;
+			else if (written)
+			{
+				int		len = item_vxid(&hdr->rings[ringno], summary->pos, vxid);
+
+				if (len == 0 || len != xact_vxid_len ||
+						memcmp(vxid, xact_vxid, len) != 0)
+					break;
+			}
+		}
+
+		if (count == size)
+		{
+			size *= 2;
+			rings = repalloc(rings, sizeof(LogRing *) * size);
+			positions = repalloc(positions, sizeof(uint32) * size);
+		}
+		/* links are set under the lock, so the chain goes on anyway */
+		if (written)
+		{
+			rings[count] = &hdr->rings[ringno];
+			positions[count] = summary->pos;
+			count++;
+		}
+
+		ringno = summary->prev_ring;
+		seq = summary->prev_seq;
+	}
+
+	/* the oldest first */
+	for (i = count - 1; i >= 0; i--)
+		put_item(usercxt, rings[i], positions[i]);
+
+	pfree(rings);
+	pfree(positions);
+}
+
+/*
+ * Checks that the function could return a set in materialize mode, returns
+ * a tuplestore for the result and a copy of the result descriptor.
+ */
+static Tuplestorestate *
+begin_materialize(FunctionCallInfo fcinfo, TupleDesc *result_desc)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext		old_mcxt;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	old_mcxt = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	*result_desc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(old_mcxt);
+
+	return tupstore;
+}
+
+/*
+ * Reads logs from the rings into a tuplestore. Rings are locked in shared
+ * mode while the scan goes, and exclusively only to move reading positions.
+ */
+static Datum
+get_logged_data(PG_FUNCTION_ARGS, enum call_type ctype)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	logged_data_ctx		ctx;
+	logged_data_ctx	   *usercxt = &ctx;
+	ring_cursor		   *start = NULL;
+	int					i;
+
+	usercxt->tupstore = begin_materialize(fcinfo, &usercxt->tupdesc);
+	usercxt->nrows = 0;
+
+	usercxt->nrings = 0;
+	usercxt->rings = palloc(sizeof(LogRing *) * hdr->nrings);
+	usercxt->flush = false;
+	usercxt->from = -1;
+	usercxt->tenant_only = false;
+	usercxt->pattern = NULL;
+	usercxt->pid = 0;
+	usercxt->txid = InvalidTransactionId;
+
+	switch (ctype)
+	{
+		case ct_flush:
+			usercxt->flush = PG_GETARG_BOOL(0);
+			break;
+		case ct_from:
+			usercxt->from = PG_GETARG_INT32(0);
+			break;
+		case ct_tenant:
+			if (hdr->partition_by == PARTITION_NONE)
+				elog(ERROR, "pg_logging.partition_by is not set");
+
+			usercxt->tenant_only = true;
+			usercxt->tenant = PG_GETARG_OID(0);
+			break;
+		case ct_tail:
+			usercxt->tail = PG_GETARG_INT32(0);
+			parse_summary_filter(fcinfo, 1, &usercxt->filter);
+			break;
+		case ct_pid:
+			usercxt->pid = PG_GETARG_INT32(0);
+			break;
+		case ct_xact:
+			usercxt->txid = (TransactionId) PG_GETARG_INT64(0);
+			break;
+		case ct_grep:
+		{
+			text   *pattern = PG_GETARG_TEXT_PP(0);
+
+			usercxt->pattern_len = VARSIZE_ANY_EXHDR(pattern);
+			usercxt->pattern = palloc(usercxt->pattern_len + 1);
+			memcpy(usercxt->pattern, VARDATA_ANY(pattern), usercxt->pattern_len);
+			usercxt->crossbuf = palloc(usercxt->pattern_len * 2 + 1);
+			break;
+		}
+	}
+
+	/* rings are added in order of their locking */
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		if (usercxt->tenant_only && i % hdr->npartitions !=
+				get_partition(usercxt->tenant, usercxt->tenant))
+			continue;
+
+		usercxt->rings[usercxt->nrings++] = &hdr->rings[i];
+	}
+
+	usercxt->batch_mcxt = AllocSetContextCreate(CurrentMemoryContext,
+												"pg_logging batch",
+												ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * Rings are scanned under shared locks, so readers don't wait for each
+	 * other. Reading positions are moved under exclusive locks after the
+	 * scan.
+	 */
+	usercxt->cursors = palloc(sizeof(ring_cursor) * usercxt->nrings);
+	lock_rings(usercxt, LW_SHARED);
+	for (i = 0; i < usercxt->nrings; i++)
+	{
+		LogRing *ring = usercxt->rings[i];
+
+		usercxt->cursors[i].until = ring->endpos;
+		usercxt->cursors[i].reading_pos = ring->readpos;
+		usercxt->cursors[i].seq = ring->read_seq;
+		usercxt->cursors[i].wraparound = ring->wraparound;
+	}
+
+	pg_read_barrier();
+
+	if (usercxt->from > 0)
+	{
+		if (!seek_from_position(usercxt))
+		{
+			release_rings(usercxt);
+			elog(ERROR, "nothing with specified position was found");
+		}
+
+		/* next time this position will be first */
+		start = palloc(sizeof(ring_cursor) * usercxt->nrings);
+		memcpy(start, usercxt->cursors, sizeof(ring_cursor) * usercxt->nrings);
+	}
+
+	switch (ctype)
+	{
+		case ct_tail:
+			put_tail_items(usercxt);
+			break;
+		case ct_pid:
+		case ct_xact:
+			put_chain_items(usercxt);
+			break;
+		default:
+			put_items(usercxt);
+			break;
+	}
+
+	release_rings(usercxt);
+	MemoryContextDelete(usercxt->batch_mcxt);
+
+	if (start != NULL || usercxt->flush)
+	{
+		lock_rings(usercxt, LW_EXCLUSIVE);
+		for (i = 0; i < usercxt->nrings; i++)
+		{
+			LogRing	   *ring = usercxt->rings[i];
+
+			if (start != NULL)
+				move_read_position(ring, &start[i]);
+			else if (usercxt->cursors[i].seq > ring->read_seq)
+				/* another flush could read further meanwhile */
+				move_read_position(ring, &usercxt->cursors[i]);
+		}
+		release_rings(usercxt);
+	}
+
+	/*
+	 * get_log is declared as returning one row, keep returning a row of nulls
+	 * for empty logs like before.
+	 */
+	rsinfo->returnMode = SFRM_Materialize;
+	if (usercxt->nrows > 0)
+	{
+		rsinfo->setResult = usercxt->tupstore;
+		rsinfo->setDesc = usercxt->tupdesc;
+	}
+	else
+		tuplestore_end(usercxt->tupstore);
+
+	return (Datum) 0;
+}
+
+Datum
+get_logged_data_flush(PG_FUNCTION_ARGS)
+{
+	return get_logged_data(fcinfo, ct_flush);
+}
+
+Datum
+get_logged_data_from(PG_FUNCTION_ARGS)
+{
+	return get_logged_data(fcinfo, ct_from);
+}
+
+Datum
+get_logged_data_tenant(PG_FUNCTION_ARGS)
+{
+	return get_logged_data(fcinfo, ct_tenant);
+}
+
+Datum
+get_logged_data_grep(PG_FUNCTION_ARGS)
+{
+	return get_logged_data(fcinfo, ct_grep);
+}
+
+Datum
+get_logged_data_pid(PG_FUNCTION_ARGS)
+{
+	return get_logged_data(fcinfo, ct_pid);
+}
+
+Datum
+get_logged_data_xact(PG_FUNCTION_ARGS)
+{
+	return get_logged_data(fcinfo, ct_xact);
+}
+
+Datum
+get_logged_data_tail(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0) || PG_GETARG_INT32(0) < 0)
+		elog(ERROR, "number of items should not be negative");
+
+	return get_logged_data(fcinfo, ct_tail);
+}
+
+/*
+ * Puts complete items from `seq` to `until` which go one after another from
+ * the start of the chunk `c`, items before the reading position are skipped.
+ */
+static void
+put_chunk_items(logged_data_ctx *usercxt, LogRing *ring, int c, uint64 seq,
+				uint64 until)
+{
+	for (seq = Max(seq, ring->read_seq); seq < until; seq++)
+	{
+		ItemSummary	   *summary = RING_SUMMARY(ring, seq);
+
+		if (summary->seq != seq || RING_CHUNK(ring, summary->pos) != c)
+			break;
+
+		if (summary->written != (uint32) seq)
+			continue;
+
+		pg_read_barrier();
+		put_item(usercxt, ring, summary->pos);
+	}
+}
+
+/*
+ * Returns logs from the reading positions which start in one of `nparts`
+ * ranges of chunks of each ring, without moving the reading positions. An
+ * item always starts in the same chunk, so parts never overlap even if
+ * they are read at different times, and they could be read by parallel
+ * workers. Each part starts from the first items of its own chunks and
+ * never looks at items of other parts, and rings are locked in shared mode
+ * one by one, so parts don't block each other.
+ */
+Datum
+get_logged_data_partial(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	int					part = PG_GETARG_INT32(0);
+	int					nparts = PG_GETARG_INT32(1);
+	logged_data_ctx		ctx;
+	int					i;
+
+	if (nparts <= 0 || part < 0 || part >= nparts)
+		elog(ERROR, "part should be from 0 to nparts - 1");
+
+	ctx.tupstore = begin_materialize(fcinfo, &ctx.tupdesc);
+	ctx.nrows = 0;
+	ctx.batch_mcxt = AllocSetContextCreate(CurrentMemoryContext,
+										   "pg_logging batch",
+										   ALLOCSET_DEFAULT_SIZES);
+
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		LogRing	   *ring = &hdr->rings[i];
+		LogChunk   *chunks = RING_CHUNKS(ring);
+		int			c,
+					last;
+
+		/* chunks where chunk * nparts / nchunks == part */
+		c = ((int64) part * ring->nchunks + nparts - 1) / nparts;
+		last = ((int64) (part + 1) * ring->nchunks + nparts - 1) / nparts;
+
+		RING_LOCK_SHARED(ring);
+		for (; c < last; c++)
+		{
+			uint64		until = ring->next_seq;
+
+			/* the oldest items could follow the newest ones in the chunk */
+			if (RING_CHUNK(ring, ring->firstpos) == c &&
+					chunks[c].first != ring->firstpos)
+			{
+				if (chunks[c].first != INVALID_ITEM_POS)
+					until = Max(chunks[c].seq, ring->first_seq);
+				put_chunk_items(&ctx, ring, c, ring->first_seq, until);
+			}
+
+			if (chunks[c].first != INVALID_ITEM_POS)
+				put_chunk_items(&ctx, ring, c, chunks[c].seq, ring->next_seq);
+		}
+		RING_RELEASE(ring);
+	}
+
+	MemoryContextDelete(ctx.batch_mcxt);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = ctx.tupstore;
+	rsinfo->setDesc = ctx.tupdesc;
+
+	return (Datum) 0;
+}
+
+/*
+ * Returns logs of the current session from the session ring, shared memory
+ * is not locked at all.
+ */
+Datum
+get_session_logged_data(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	SessionRing		   *sr = &session_ring;
+	bool				flush = PG_GETARG_BOOL(0);
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	uint32				pos;
+	int					i;
+
+	tupstore = begin_materialize(fcinfo, &tupdesc);
+
+	/* logs written while reading are skipped */
+	sr->reading = true;
+	PG_TRY();
+	{
+		pos = sr->first;
+		for (i = 0; i < sr->nitems; i++)
+		{
+			Datum	values[Natts_pg_logging_data];
+			bool	isnull[Natts_pg_logging_data];
+
+			fill_values_from(sr->data, sr->size, pos, values, isnull);
+			tuplestore_putvalues(tupstore, tupdesc, values, isnull);
+
+			pos += ((CollectedItem *) (sr->data + pos))->totallen;
+			if (sr->wrapped && pos == sr->tail)
+				pos = 0;
+		}
+	}
+	PG_CATCH();
+	{
+		sr->reading = false;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	sr->reading = false;
+
+	if (flush)
+	{
+		sr->first = sr->end = 0;
+		sr->wrapped = false;
+		sr->nitems = 0;
+	}
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}
+
+static int
+parse_sqlstate(char *str, bool *errclass)
+{
+	int		len = strlen(str);
+	int		i;
+
+	if (len != 2 && len != 5)
+		elog(ERROR, "errcode should be SQLSTATE code or class: %s", str);
+
+	for (i = 0; i < len; i++)
+	{
+		str[i] = toupper((unsigned char) str[i]);
+		if (!isdigit((unsigned char) str[i]) && !isupper((unsigned char) str[i]))
+			elog(ERROR, "invalid SQLSTATE: %s", str);
+	}
+
+	*errclass = (len == 2);
+	if (*errclass)
+		return ERRCODE_TO_CATEGORY(MAKE_SQLSTATE(str[0], str[1], '0', '0', '0'));
+
+	return MAKE_SQLSTATE(str[0], str[1], str[2], str[3], str[4]);
+}
+
+/* Reads summary_filter from level, datid, userid and errcode arguments */
+static void
+parse_summary_filter(FunctionCallInfo fcinfo, int argno, summary_filter *filter)
+{
+	MemSet(filter, 0, sizeof(summary_filter));
+
+	if (!PG_ARGISNULL(argno))
+		filter->minlevel = PG_GETARG_INT32(argno);
+	if (!PG_ARGISNULL(argno + 1))
+		filter->database_id = PG_GETARG_OID(argno + 1);
+	if (!PG_ARGISNULL(argno + 2))
+		filter->user_id = PG_GETARG_OID(argno + 2);
+	if (!PG_ARGISNULL(argno + 3))
+	{
+		filter->has_errcode = true;
+		filter->sqlerrcode = parse_sqlstate(text_to_cstring(PG_GETARG_TEXT_PP(argno + 3)),
+											&filter->errclass);
+	}
+}
+
+/*
+ * Counts logs in the buffer using only summaries of items, texts are not
+ * touched at all. Null arguments match anything, level is the minimal one.
+ */
+Datum
+count_logged_data(PG_FUNCTION_ARGS)
+{
+	summary_filter	filter;
+	int64			count = 0;
+	int				i;
+
+	parse_summary_filter(fcinfo, 0, &filter);
+
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		LogRing	   *ring = &hdr->rings[i];
+		uint64		seq;
+
+		RING_LOCK_SHARED(ring);
+		for (seq = ring->read_seq; seq < ring->next_seq; seq++)
+		{
+			if (summary_matches(RING_SUMMARY(ring, seq), &filter))
+				count++;
+		}
+		RING_RELEASE(ring);
+	}
+
+	PG_RETURN_INT64(count);
+}
+
+/* Filters drop logs of the whole cluster, like pg_logging.minlevel */
+static void
+check_filters_privilege(void)
+{
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to change capture filters")));
+}
+
+Datum
+add_filter(PG_FUNCTION_ARGS)
+{
+	LogFilter	filter;
+	char	   *action;
+	int			num;
+
+	check_filters_privilege();
+
+	if (PG_ARGISNULL(0))
+		elog(ERROR, "action should be 'include' or 'exclude'");
+
+	MemSet(&filter, 0, sizeof(LogFilter));
+	action = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	if (strcmp(action, "exclude") == 0)
+		filter.exclude = true;
+	else if (strcmp(action, "include") != 0)
+		elog(ERROR, "action should be 'include' or 'exclude'");
+
+	if (!PG_ARGISNULL(1))
+		filter.database_id = PG_GETARG_OID(1);
+	if (!PG_ARGISNULL(2))
+		filter.user_id = PG_GETARG_OID(2);
+	if (!PG_ARGISNULL(3))
+	{
+		filter.has_errcode = true;
+		filter.sqlerrcode = parse_sqlstate(text_to_cstring(PG_GETARG_TEXT_PP(3)),
+										   &filter.errclass);
+	}
+	if (!PG_ARGISNULL(4))
+	{
+		char	   *pattern = text_to_cstring(PG_GETARG_TEXT_PP(4));
+		regex_t		re;
+		int			rc;
+
+		if (strlen(pattern) >= MAX_FILTER_REGEX)
+			elog(ERROR, "message pattern is too long");
+
+		rc = compile_filter_regex(pattern, &re);
+		if (rc != REG_OKAY)
+		{
+			char	errstr[100];
+
+			pg_regerror(rc, &re, errstr, sizeof(errstr));
+			elog(ERROR, "invalid message pattern: %s", errstr);
+		}
+		pg_regfree(&re);
+		strcpy(filter.regex, pattern);
+	}
+
+	HDR_LOCK();
+	if (hdr->nfilters >= MAX_FILTERS)
+	{
+		HDR_RELEASE();
+		elog(ERROR, "too many filters, maximum is %d", MAX_FILTERS);
+	}
+	num = hdr->nfilters++;
+	memcpy(&hdr->filters[num], &filter, sizeof(LogFilter));
+	pg_write_barrier();
+	hdr->filters_gen++;
+	HDR_RELEASE();
+
+	PG_RETURN_INT32(num + 1);
+}
+
+Datum
+clear_filters(PG_FUNCTION_ARGS)
+{
+	check_filters_privilege();
+
+	HDR_LOCK();
+	hdr->nfilters = 0;
+	pg_write_barrier();
+	hdr->filters_gen++;
+	HDR_RELEASE();
+
+	PG_RETURN_VOID();
+}
+
+Datum
+get_filters(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	   *funccxt;
+	LogFilter		   *filters;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext	old_mcxt;
+		TupleDesc		tupdesc;
+
+		funccxt = SRF_FIRSTCALL_INIT();
+		old_mcxt = MemoryContextSwitchTo(funccxt->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funccxt->tuple_desc = BlessTupleDesc(tupdesc);
+
+		filters = palloc(sizeof(LogFilter) * MAX_FILTERS);
+		HDR_LOCK();
+		funccxt->max_calls = hdr->nfilters;
+		memcpy(filters, hdr->filters, sizeof(LogFilter) * hdr->nfilters);
+		HDR_RELEASE();
+		funccxt->user_fctx = filters;
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	funccxt = SRF_PERCALL_SETUP();
+	filters = (LogFilter *) funccxt->user_fctx;
+
+	if (funccxt->call_cntr < funccxt->max_calls)
+	{
+		LogFilter  *filter = &filters[funccxt->call_cntr];
+		Datum		values[Natts_pg_logging_filter];
+		bool		isnull[Natts_pg_logging_filter];
+		HeapTuple	htup;
+
+		MemSet(isnull, 0, sizeof(isnull));
+		values[Anum_pg_logging_filter_num - 1] = Int32GetDatum(funccxt->call_cntr + 1);
+		values[Anum_pg_logging_filter_action - 1] =
+			CStringGetTextDatum(filter->exclude ? "exclude" : "include");
+
+		if (OidIsValid(filter->database_id))
+			values[Anum_pg_logging_filter_datid - 1] = ObjectIdGetDatum(filter->database_id);
+		else
+			isnull[Anum_pg_logging_filter_datid - 1] = true;
+
+		if (OidIsValid(filter->user_id))
+			values[Anum_pg_logging_filter_userid - 1] = ObjectIdGetDatum(filter->user_id);
+		else
+			isnull[Anum_pg_logging_filter_userid - 1] = true;
+
+		if (filter->has_errcode)
+		{
+			char   *state = unpack_sql_state(filter->sqlerrcode);
+
+			values[Anum_pg_logging_filter_errcode - 1] =
+				PointerGetDatum(cstring_to_text_with_len(state,
+											filter->errclass ? 2 : 5));
+		}
+		else
+			isnull[Anum_pg_logging_filter_errcode - 1] = true;
+
+		if (filter->regex[0])
+			values[Anum_pg_logging_filter_message - 1] = CStringGetTextDatum(filter->regex);
+		else
+			isnull[Anum_pg_logging_filter_message - 1] = true;
+
+		htup = heap_form_tuple(funccxt->tuple_desc, values, isnull);
+		SRF_RETURN_NEXT(funccxt, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funccxt);
+}
+
+Datum
+test_ereport(PG_FUNCTION_ARGS)
+{
+	ereport(PG_GETARG_INT32(0),
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("%s", PG_GETARG_CSTRING(1)),
+			 errdetail("%s", PG_GETARG_CSTRING(2)),
+			 errhint("%s", PG_GETARG_CSTRING(3))));
+	PG_RETURN_VOID();
+}
+
+/*
+ * Calls the hook with the same error data `loops` times and returns average
+ * time of a call in nanoseconds.
+ */
+Datum
+bench_log_hook(PG_FUNCTION_ARGS)
+{
+	int			loops = PG_GETARG_INT32(0);
+	ErrorData	edata;
+	instr_time	start,
+				duration;
+	int			i;
+
+	/* it fills the shared buffer and evicts real logs */
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to run bench_log_hook")));
+
+	if (loops <= 0)
+		elog(ERROR, "number of loops should be positive");
+
+	MemSet(&edata, 0, sizeof(ErrorData));
+	edata.elevel = PG_GETARG_INT32(1);
+	edata.sqlerrcode = ERRCODE_FEATURE_NOT_SUPPORTED;
+	edata.filename = __FILE__;
+	edata.lineno = __LINE__;
+	edata.funcname = PG_FUNCNAME_MACRO;
+	edata.domain = TEXTDOMAIN;
+	edata.message = "pg_logging benchmark";
+	edata.message_id = "pg_logging benchmark";
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (i = 0; i < loops; i++)
+		copy_error_data_to_shmem(&edata);
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	PG_RETURN_FLOAT8(INSTR_TIME_GET_DOUBLE(duration) * 1000000000.0 / loops);
+}
+
+Datum
+errlevel_out(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_CSTRING(get_errlevel_name(PG_GETARG_INT32(0)));
+}
+
+static char *
+lowerstr(char *str)
+{
+	int		i;
+	char   *res = pstrdup(str);
+
+	for (i = 0; str[i]; i++)
+	{
+		res[i] = tolower(str[i]);
+	}
+
+	return res;
+}
+
+Datum
+errlevel_in(PG_FUNCTION_ARGS)
+{
+	char   *str = lowerstr(PG_GETARG_CSTRING(0));
+	int		len = strlen(str);
+	struct ErrorLevel *el;
+
+	if (len == 0)
+		elog(ERROR, "Empty status name");
+
+	el = get_errlevel(str, len);
+	if (!el)
+		elog(ERROR, "Unknown level name: %s", str);
+
+	PG_RETURN_INT32(el->code);
+}
+
+static int
+rollup_row_cmp(const void *a, const void *b)
+{
+	const rollup_row *r1 = (const rollup_row *) a;
+	const rollup_row *r2 = (const rollup_row *) b;
+
+	if (r1->start != r2->start)
+		return r1->start < r2->start ? -1 : 1;
+	if (r1->key != r2->key)
+		return r1->key < r2->key ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Copies counters of intervals ending after `since`, the bucket is skipped
+ * if it was given to another interval while we read it.
+ */
+static int
+collect_rollup(TimestampTz since, rollup_row *rows)
+{
+	int64		len = (int64) hdr->rollup_interval * USECS_PER_SEC;
+	uint64		last = GetCurrentTimestamp() / len;
+	int			nrows = 0;
+	int			k;
+
+	for (k = 0; k < ROLLUP_BUCKETS && k <= last; k++)
+	{
+		uint64			interval = last - k;
+		RollupBucket   *bucket = &hdr->rollup[interval % ROLLUP_BUCKETS];
+		TimestampTz		start = interval * len;
+		int				first = nrows;
+		uint32			overflow;
+		int				i;
+
+		if (start + len <= since)
+			break;
+
+		if (pg_atomic_read_u64(&bucket->interval) != interval + 1)
+			continue;
+
+		for (i = 0; i < ROLLUP_SLOTS; i++)
+		{
+			uint64	key = pg_atomic_read_u64(&bucket->slots[i].key);
+			uint32	count = pg_atomic_read_u32(&bucket->slots[i].count);
+
+			if (key != 0 && count != 0)
+			{
+				rows[nrows].start = start;
+				rows[nrows].key = key;
+				rows[nrows].count = count;
+				nrows++;
+			}
+		}
+
+		overflow = pg_atomic_read_u32(&bucket->overflow);
+		if (overflow != 0)
+		{
+			rows[nrows].start = start;
+			rows[nrows].key = 0;
+			rows[nrows].count = overflow;
+			nrows++;
+		}
+
+		pg_read_barrier();
+		if (pg_atomic_read_u64(&bucket->interval) != interval + 1)
+			nrows = first;
+	}
+
+	qsort(rows, nrows, sizeof(rollup_row), rollup_row_cmp);
+	return nrows;
+}
+
+Datum
+get_rollup(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	   *funccxt;
+	rollup_row		   *rows;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext	old_mcxt;
+		TupleDesc		tupdesc;
+		TimestampTz		since = PG_ARGISNULL(0) ? 0 : PG_GETARG_TIMESTAMPTZ(0);
+
+		funccxt = SRF_FIRSTCALL_INIT();
+		old_mcxt = MemoryContextSwitchTo(funccxt->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funccxt->tuple_desc = BlessTupleDesc(tupdesc);
+
+		rows = palloc(sizeof(rollup_row) * ROLLUP_BUCKETS * (ROLLUP_SLOTS + 1));
+		funccxt->max_calls = collect_rollup(since, rows);
+		funccxt->user_fctx = rows;
+
+		MemoryContextSwitchTo(old_mcxt);
+	}
+
+	funccxt = SRF_PERCALL_SETUP();
+	rows = (rollup_row *) funccxt->user_fctx;
+
+	if (funccxt->call_cntr < funccxt->max_calls)
+	{
+		rollup_row *row = &rows[funccxt->call_cntr];
+		Datum		values[Natts_pg_logging_rollup];
+		bool		isnull[Natts_pg_logging_rollup];
+		HeapTuple	htup;
+
+		MemSet(isnull, 0, sizeof(isnull));
+		values[Anum_pg_logging_rollup_start - 1] = TimestampTzGetDatum(row->start);
+		values[Anum_pg_logging_rollup_count - 1] = Int64GetDatum(row->count);
+
+		if (row->key != 0)
+		{
+			values[Anum_pg_logging_rollup_datid - 1] =
+				ObjectIdGetDatum(ROLLUP_KEY_DBID(row->key));
+			values[Anum_pg_logging_rollup_level - 1] =
+				Int32GetDatum(ROLLUP_KEY_ELEVEL(row->key));
+			values[Anum_pg_logging_rollup_errclass - 1] =
+				PointerGetDatum(cstring_to_text_with_len(
+					unpack_sql_state(ROLLUP_KEY_ERRCLASS(row->key)), 2));
+		}
+		else
+		{
+			/* logs which didn't fit to slots */
+			isnull[Anum_pg_logging_rollup_datid - 1] = true;
+			isnull[Anum_pg_logging_rollup_level - 1] = true;
+			isnull[Anum_pg_logging_rollup_errclass - 1] = true;
+		}
+
+		htup = heap_form_tuple(funccxt->tuple_desc, values, isnull);
+		SRF_RETURN_NEXT(funccxt, HeapTupleGetDatum(htup));
+	}
+
+	SRF_RETURN_DONE(funccxt);
+}
+
+Datum
+get_export_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[2];
+	bool		isnull[2] = {false, false};
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	values[0] = Int64GetDatum((int64) pg_atomic_read_u64(&hdr->export_sent));
+	values[1] = Int64GetDatum((int64) pg_atomic_read_u64(&hdr->export_dropped));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc),
+													  values, isnull)));
+}
+
+/*
+ * Returns retention horizon, average ingest rate over the horizon and load
+ * shedding state for each ring.
+ */
+Datum
+get_shedding_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	TimestampTz			now = GetCurrentTimestamp();
+	int					i;
+
+	tupstore = begin_materialize(fcinfo, &tupdesc);
+
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		LogRing	   *ring = &hdr->rings[i];
+		Datum		values[7];
+		bool		isnull[7];
+		TimestampTz	oldest = 0;
+		uint64		nitems;
+		int			shed_level;
+
+		RING_LOCK_SHARED(ring);
+		nitems = ring->next_seq - ring->first_seq;
+		if (nitems > 0)
+			oldest = RING_SUMMARY(ring, ring->first_seq)->logtime;
+		shed_level = ring->shed_level;
+		values[4] = Int64GetDatum((int64) ring->shed_raised);
+		values[5] = Int64GetDatum((int64) ring->shed_relaxed);
+		RING_RELEASE(ring);
+
+		MemSet(isnull, 0, sizeof(isnull));
+		values[0] = Int32GetDatum(i);
+		if (nitems > 0)
+		{
+			Interval   *horizon = palloc0(sizeof(Interval));
+
+			horizon->time = Max(now - oldest, 0);
+			values[1] = IntervalPGetDatum(horizon);
+			values[2] = Float8GetDatum(horizon->time > 0 ?
+				(double) nitems * USECS_PER_SEC / horizon->time : 0.0);
+		}
+		else
+			isnull[1] = isnull[2] = true;
+
+		values[3] = Int32GetDatum(shed_level);
+		isnull[3] = (shed_level == 0);
+		values[6] = Int64GetDatum((int64) pg_atomic_read_u64(&ring->shed_count));
+
+		tuplestore_putvalues(tupstore, tupdesc, values, isnull);
+	}
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}
+
+static LogSnapshot *
+find_snapshot(const char *name)
+{
+	int		i;
+
+	for (i = 0; i < MAX_SNAPSHOTS; i++)
+		if (strcmp(hdr->snapshots[i].name, name) == 0)
+			return &hdr->snapshots[i];
+
+	return NULL;
+}
+
+/* Returns total size of complete logs from the reading positions */
+static Size
+unread_items_size(void)
+{
+	Size	size = 0;
+	int		i;
+
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		LogRing	   *ring = &hdr->rings[i];
+		uint64		seq;
+
+		RING_LOCK_SHARED(ring);
+		for (seq = ring->read_seq; seq < ring->next_seq; seq++)
+		{
+			ItemSummary	   *summary = RING_SUMMARY(ring, seq);
+
+			if (summary->written == (uint32) seq)
+				size += summary->totallen;
+		}
+		RING_RELEASE(ring);
+	}
+
+	return size;
+}
+
+/*
+ * Copies complete logs from the reading positions of all rings to `dest`.
+ * Logs could be written since the size was computed, logs which don't fit
+ * are skipped. Each ring is locked in shared mode while it's copied, that
+ * keeps its complete logs from being overwritten, and logs still being
+ * written are skipped by their marks, so writers to other rings and readers
+ * are not stopped. Nothing here could fail while a ring is locked.
+ */
+static int
+copy_unread_items(char *dest, Size size, Size *copied)
+{
+	int		nitems = 0;
+	Size	used = 0;
+	int		i;
+
+	for (i = 0; i < hdr->nrings; i++)
+	{
+		LogRing	   *ring = &hdr->rings[i];
+		char	   *ringdata = RING_DATA(ring);
+		uint64		seq;
+
+		RING_LOCK_SHARED(ring);
+		for (seq = ring->read_seq; seq < ring->next_seq; seq++)
+		{
+			ItemSummary	   *summary = RING_SUMMARY(ring, seq);
+			int				part1;
+
+			if (summary->written != (uint32) seq)
+				continue;
+
+			pg_read_barrier();
+			if (summary->totallen > size - used)
+				continue;
+
+			part1 = Min(summary->totallen, ring->buffer_size - summary->pos);
+			memcpy(dest + used, ringdata + summary->pos, part1);
+			memcpy(dest + used + part1, ringdata, summary->totallen - part1);
+			used += summary->totallen;
+			nitems++;
+		}
+		RING_RELEASE(ring);
+	}
+
+	*copied = used;
+	return nitems;
+}
+
+/* Frees the snapshot slot reserved by this backend if it fails or exits */
+static void
+release_snapshot_slot(int code, Datum arg)
+{
+	LogSnapshot	   *snapshot = (LogSnapshot *) DatumGetPointer(arg);
+
+	HDR_LOCK();
+	snapshot->name[0] = '\0';
+	HDR_RELEASE();
+}
+
+static void
+check_snapshots_privilege(void)
+{
+	/* snapshots take shared memory until they are dropped */
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to create or drop log snapshots")));
+}
+
+/*
+ * Copies logs from the reading positions to a new DSM segment, which any
+ * session could read by name as many times as needed. The segment is sized
+ * first, then each ring is locked in shared mode while its logs are copied
+ * straight to it. hdr_lock is never held while DSM
+ * functions are called, because they could log something.
+ */
+Datum
+create_log_snapshot(PG_FUNCTION_ARGS)
+{
+	char		   *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	LogSnapshot	   *snapshot = NULL;
+	dsm_segment	   *seg;
+	Size			size;
+	int				nitems;
+	int				i;
+
+	check_snapshots_privilege();
+
+	if (name[0] == '\0' || strlen(name) >= NAMEDATALEN)
+		elog(ERROR, "snapshot name should be from 1 to %d bytes long",
+			 NAMEDATALEN - 1);
+
+	/* reserve the name */
+	HDR_LOCK();
+	if (find_snapshot(name) != NULL)
+	{
+		HDR_RELEASE();
+		elog(ERROR, "snapshot \"%s\" already exists", name);
+	}
+	for (i = 0; i < MAX_SNAPSHOTS && snapshot == NULL; i++)
+		if (hdr->snapshots[i].name[0] == '\0')
+			snapshot = &hdr->snapshots[i];
+	if (snapshot != NULL)
+	{
+		strlcpy(snapshot->name, name, NAMEDATALEN);
+		snapshot->ready = false;
+	}
+	HDR_RELEASE();
+
+	if (snapshot == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many log snapshots"),
+				 errhint("Drop unused snapshots with drop_log_snapshot().")));
+
+	/* the slot is released on errors and if the backend exits */
+	PG_ENSURE_ERROR_CLEANUP(release_snapshot_slot, PointerGetDatum(snapshot));
+	{
+		Size	allocated = unread_items_size();
+
+		seg = dsm_create(Max(allocated, 1), 0);
+		nitems = copy_unread_items(dsm_segment_address(seg), allocated, &size);
+		dsm_pin_segment(seg);
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(release_snapshot_slot, PointerGetDatum(snapshot));
+
+	HDR_LOCK();
+	snapshot->handle = dsm_segment_handle(seg);
+	snapshot->created = GetCurrentTimestamp();
+	snapshot->nitems = nitems;
+	snapshot->size = size;
+	snapshot->ready = true;
+	HDR_RELEASE();
+
+	dsm_detach(seg);
+
+	PG_RETURN_INT32(nitems);
+}
+
+/*
+ * Returns logs from the snapshot. The segment is only read, so the rings
+ * are not locked and any number of sessions could read it at once.
+ * `position` is null for these logs.
+ */
+Datum
+get_log_snapshot(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	char			   *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	LogSnapshot		   *snapshot;
+	dsm_handle			handle = 0;
+	Size				size = 0;
+	bool				ready = false;
+	dsm_segment		   *seg;
+	bool				attached = false;
+	char			   *data;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	MemoryContext		row_mcxt,
+						old_mcxt;
+	Size				pos;
+
+	tupstore = begin_materialize(fcinfo, &tupdesc);
+
+	HDR_LOCK();
+	snapshot = find_snapshot(name);
+	if (snapshot != NULL && snapshot->ready)
+	{
+		handle = snapshot->handle;
+		size = snapshot->size;
+		ready = true;
+	}
+	HDR_RELEASE();
+
+	if (snapshot == NULL)
+		elog(ERROR, "snapshot \"%s\" does not exist", name);
+	if (!ready)
+		elog(ERROR, "snapshot \"%s\" is being created", name);
+
+	seg = dsm_find_mapping(handle);
+	if (seg == NULL)
+	{
+		seg = dsm_attach(handle);
+		if (seg == NULL)
+			elog(ERROR, "snapshot \"%s\" was dropped", name);
+		attached = true;
+	}
+
+	data = dsm_segment_address(seg);
+	row_mcxt = AllocSetContextCreate(CurrentMemoryContext,
+									 "pg_logging snapshot row",
+									 ALLOCSET_DEFAULT_SIZES);
+	for (pos = 0; pos < size; pos += ((CollectedItem *) (data + pos))->totallen)
+	{
+		Datum	values[Natts_pg_logging_data];
+		bool	isnull[Natts_pg_logging_data];
+
+		old_mcxt = MemoryContextSwitchTo(row_mcxt);
+		fill_values_from(data, size, pos, values, isnull);
+		tuplestore_putvalues(tupstore, tupdesc, values, isnull);
+		MemoryContextSwitchTo(old_mcxt);
+		MemoryContextReset(row_mcxt);
+	}
+	MemoryContextDelete(row_mcxt);
+
+	if (attached)
+		dsm_detach(seg);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}
+
+Datum
+drop_log_snapshot(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	char		   *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	LogSnapshot	   *snapshot;
+	dsm_handle		handle = 0;
+	bool			ready = false;
+
+	check_snapshots_privilege();
+
+	HDR_LOCK();
+	snapshot = find_snapshot(name);
+	if (snapshot != NULL && snapshot->ready)
+	{
+		handle = snapshot->handle;
+		ready = true;
+		snapshot->name[0] = '\0';
+	}
+	HDR_RELEASE();
+
+	if (snapshot == NULL)
+		elog(ERROR, "snapshot \"%s\" does not exist", name);
+	if (!ready)
+		elog(ERROR, "snapshot \"%s\" is being created", name);
+
+	/* the segment is freed when the last session reading it detaches */
+	dsm_unpin_segment(handle);
+	PG_RETURN_VOID();
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("log snapshots could be dropped only on PostgreSQL 10 or later"),
+			 errhint("Snapshots stay until the server is restarted.")));
+	PG_RETURN_VOID();
+#endif
+}
+
+Datum
+get_log_snapshots(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	LogSnapshot			snapshots[MAX_SNAPSHOTS];
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	int					i;
+
+	tupstore = begin_materialize(fcinfo, &tupdesc);
+
+	HDR_LOCK();
+	memcpy(snapshots, hdr->snapshots, sizeof(snapshots));
+	HDR_RELEASE();
+
+	for (i = 0; i < MAX_SNAPSHOTS; i++)
+	{
+		Datum	values[4];
+		bool	isnull[4] = {false, false, false, false};
+
+		if (snapshots[i].name[0] == '\0' || !snapshots[i].ready)
+			continue;
+
+		values[0] = CStringGetTextDatum(snapshots[i].name);
+		values[1] = TimestampTzGetDatum(snapshots[i].created);
+		values[2] = Int32GetDatum(snapshots[i].nitems);
+		values[3] = Int64GetDatum((int64) snapshots[i].size);
+		tuplestore_putvalues(tupstore, tupdesc, values, isnull);
+	}
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
 }
@@ -0,0 +1,97 @@
+/*
+ * search.c
+ *      Substring search used to grep logs in the ring buffer.
+ *
+ * Copyright (c) 2018, Postgres Professional
+ */
+#include "postgres.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "pg_logging.h"
+
+static const char *
+search_bytes_scalar(const char *hay, int n, const char *needle, int k)
+{
+	const char *end = hay + n - k + 1;
+	const char *p = hay;
+
+	while (p < end)
+	{
+		p = memchr(p, needle[0], end - p);
+		if (p == NULL)
+			return NULL;
+
+		if (memcmp(p + 1, needle + 1, k - 1) == 0)
+			return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Vectorized search: compare first and last bytes of the needle with a block
+ * of positions at once, and check the rest of the needle only for positions
+ * where both of them matched. SSE2 is always there on x86-64, wider vectors
+ * would need a check of the CPU at runtime, so they are not used.
+ */
+#if defined(__SSE2__)
+
+#define VECTOR_SIZE			16
+#define vector_t			__m128i
+#define vector_set1(c)		_mm_set1_epi8(c)
+#define vector_load(p)		_mm_loadu_si128((const __m128i *) (p))
+#define vector_match(a, b, c, d) \
+	_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, b), \
+									_mm_cmpeq_epi8(c, d)))
+
+#endif
+
+/*
+ * Returns pointer to the first occurrence of needle in hay or NULL.
+ */
+const char *
+search_bytes(const char *hay, int n, const char *needle, int k)
+{
+#ifdef VECTOR_SIZE
+	vector_t	first,
+				last;
+	int			i;
+#endif
+
+	if (k == 0)
+		return hay;
+
+	if (n < k)
+		return NULL;
+
+#ifdef VECTOR_SIZE
+	if (k == 1)
+		return memchr(hay, needle[0], n);
+
+	first = vector_set1(needle[0]);
+	last = vector_set1(needle[k - 1]);
+
+	for (i = 0; i + k - 1 + VECTOR_SIZE <= n; i += VECTOR_SIZE)
+	{
+		uint32	mask = (uint32) vector_match(first, vector_load(hay + i),
+											 last, vector_load(hay + i + k - 1));
+		int		bit;
+
+		for (bit = 0; mask != 0; bit++, mask >>= 1)
+		{
+			if ((mask & 1) &&
+				memcmp(hay + i + bit + 1, needle + 1, k - 2) == 0)
+				return hay + i + bit;
+		}
+	}
+
+	/* the tail is smaller than a vector */
+	return search_bytes_scalar(hay + i, n - i, needle, k);
+#else
+	return search_bytes_scalar(hay, n, needle, k);
+#endif
+}
@@ -45,12 +45,196 @@ select logging.test_ereport('error', 'notice1', 'detail', 'hint');
 select logging.test_ereport('error', 'notice2', 'detail', 'hint');
 select logging.test_ereport('error', 'notice3', 'detail', 'hint');
 select level, message, position from logging.get_log(false);
-select level, message, position from logging.get_log(272);
+select level, message, position from logging.get_log(328);
 select level, message, position from logging.get_log(false);
-select level, message, position from logging.get_log(544);
+select level, message, position from logging.get_log(656);
 select level, message, position from logging.get_log(false);
 select level, message, position from logging.get_log(1000);
 select level, message, position from logging.get_log(false);
 
+/* filters */
+select logging.flush_log();
+select logging.add_filter('exclude', errcode := '0A', message := '^skip');
+select * from logging.get_filters();
+select logging.test_ereport('error', 'skip1', 'detail', 'hint');
+select logging.test_ereport('error', 'keep1', 'detail', 'hint');
+select level, message from logging.get_log();
+select logging.add_filter('exclude', errcode := '00000');
+select logging.test_ereport('error', 'keep2', 'detail', 'hint');
+select level, message from logging.get_log();
+select logging.clear_filters();
+select logging.add_filter('include', message := 'a(');
+select count(*) from logging.get_filters();
+create role pl_nosuper;
+grant usage on schema logging to pl_nosuper;
+set role pl_nosuper;
+select logging.add_filter('exclude');
+select logging.clear_filters();
+reset role;
+revoke usage on schema logging from pl_nosuper;
+drop role pl_nosuper;
+select logging.clear_filters();
+
+select * from logging.get_tenant_log(1);
+
+/* object fields */
+select logging.flush_log();
+create table pl_test (id int primary key);
+insert into pl_test values (1);
+insert into pl_test values (1);
+select object_type, schema_name, table_name, constraint_name, filename, funcname from logging.get_log();
+drop table pl_test;
+
+/* message templates */
+select logging.flush_log();
+set pg_logging.store_templates = on;
+select 1/0;
+select logging.test_ereport('error', 'one', 'two', 'three');
+select message, message_template from logging.get_log();
+reset pg_logging.store_templates;
+
+/* search */
+select 1/0;
+select logging.test_ereport('error', 'one', 'two', 'three');
+select message, detail from logging.get_log_grep('zero');
+select message, detail from logging.get_log_grep('tw');
+select count(*) from logging.get_log_grep('nothing like this');
+select logging.flush_log();
+
+/* counts */
+select 1/0;
+select logging.test_ereport('error', 'one', 'two', 'three');
+select logging.count_log();
+select logging.count_log('fatal');
+select logging.count_log(errcode := '22012');
+select logging.count_log(errcode := '0A');
+select logging.count_log(errcode := '00');
+select logging.flush_log();
+
+/* tail */
+select 1/0;
+select logging.test_ereport('error', 'one', 'two', 'three');
+select logging.test_ereport('error', 'four', 'five', 'six');
+select message from logging.get_log_tail(2);
+select message from logging.get_log_tail(5, errcode := '0A');
+select message from logging.get_log_tail(1, errcode := '22012');
+select logging.flush_log();
+
+/* backend and transaction logs */
+select 1/0;
+begin;
+create temp table pl_xact_test (id int);
+select logging.test_ereport('error', 'one', 'two', 'three');
+rollback;
+select message from logging.get_log_for_pid(pg_backend_pid());
+select message from logging.get_log_for_xact((select txid from logging.get_log_tail(1)));
+select count(*) from logging.get_log_for_pid(0);
+select logging.flush_log();
+
+/* logs written before the transaction got its id */
+begin;
+savepoint s;
+select logging.test_ereport('error', 'before xid', 'two', 'three');
+rollback to s;
+create temp table pl_xact_test (id int);
+select logging.test_ereport('error', 'after xid', 'two', 'three');
+rollback;
+select message from logging.get_log_for_xact((select txid from logging.get_log_tail(1)));
+select logging.flush_log();
+
+/* session values changed after the first log */
+set application_name = 'pl_app1';
+select 1/0;
+set application_name = 'pl_app2';
+select 1/0;
+select appname from logging.get_log_tail(2);
+reset application_name;
+select logging.flush_log();
+
+/* hook benchmark */
+select logging.bench_log_hook(10, 'error') > 0;
+select logging.count_log();
+select logging.flush_log();
+create role pl_nosuper;
+grant usage on schema logging to pl_nosuper;
+set role pl_nosuper;
+select logging.bench_log_hook(10);
+reset role;
+revoke usage on schema logging from pl_nosuper;
+drop role pl_nosuper;
+select logging.flush_log();
+
+/* rollups */
+select count(*) > 0 from logging.get_log_rollup();
+select count(*) from logging.get_log_rollup(now() + interval '1 day');
+select coalesce(sum(count), 0) as rollup_before from logging.get_log_rollup() where errclass = '22' \gset
+select logging.add_filter('exclude', errcode := '22012');
+select 1/0;
+select logging.clear_filters();
+select sum(count) - :rollup_before from logging.get_log_rollup() where errclass = '22';
+
+/* session logs */
+set pg_logging.session_buffer_size = 64;
+select 1/0;
+select logging.test_ereport('error', 'one', 'two', 'three');
+select message, position is null from logging.get_my_log(false);
+select message from logging.get_my_log();
+select count(*) from logging.get_my_log();
+set pg_logging.session_buffer_size = 64;
+select 1/0;
+set pg_logging.session_buffer_size = 0;
+select count(*) from logging.get_my_log(false);
+reset pg_logging.session_buffer_size;
+select logging.flush_log();
+
+/* exporter is not running in tests */
+select * from logging.get_export_stats();
+
+/* repeats */
+set pg_logging.collapse_repeats = on;
+select logging.test_ereport('error', 'again', 'two', 'three');
+select logging.test_ereport('error', 'again', 'two', 'three');
+select logging.test_ereport('error', 'again', 'two', 'three');
+select logging.test_ereport('error', 'other', 'two', 'three');
+select message, repeat_count, last_log_time is not null as repeated from logging.get_log();
+reset pg_logging.collapse_repeats;
+
+/* partial reads */
+select logging.test_ereport('error', 'part1', 'two', 'three');
+select logging.test_ereport('error', 'part2', 'two', 'three');
+select message from logging.get_log_partial(0, 2)
+union all select message from logging.get_log_partial(1, 2) order by 1;
+select count(*) from logging.get_log_partial(0, 1);
+select logging.get_log_partial(2, 2);
+select logging.flush_log();
+select count(*) from logging.get_log_partial(0, 1);
+
+/* load shedding */
+set pg_logging.shed_horizon = '1h';
+select ring, horizon is not null as has_horizon, shed_level, raised, relaxed, shed
+from logging.get_shedding_stats();
+reset pg_logging.shed_horizon;
+
+/* snapshots */
+select logging.test_ereport('error', 'snap1', 'two', 'three');
+select logging.create_log_snapshot('incident');
+select logging.test_ereport('error', 'snap2', 'two', 'three');
+select message from logging.get_log_snapshot('incident');
+select message from logging.get_log_snapshot('incident');
+select count(*) from logging.get_log(false) where message like 'snap%';
+select name, logs from logging.get_log_snapshots();
+create role pl_nosuper;
+grant usage on schema logging to pl_nosuper;
+set role pl_nosuper;
+select logging.create_log_snapshot('other');
+select message from logging.get_log_snapshot('incident');
+reset role;
+revoke usage on schema logging from pl_nosuper;
+drop role pl_nosuper;
+select logging.create_log_snapshot('incident');
+select logging.drop_log_snapshot('incident');
+select logging.get_log_snapshot('incident');
+select logging.flush_log();
+
 reset log_statement;
 drop extension pg_logging cascade;
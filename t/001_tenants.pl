@@ -0,0 +1,50 @@
+# get_tenant_log with the buffer partitioned by databases
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 4;
+
+my $node = get_new_node('tenants');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+pg_logging.partition_by = 'database'
+pg_logging.partitions = 4
+});
+$node->start;
+
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+
+my %oid;
+foreach my $db ('db1', 'db2')
+{
+	$node->safe_psql('postgres', "create database $db");
+	$oid{$db} = $node->safe_psql('postgres',
+		"select oid from pg_database where datname = '$db'");
+}
+
+foreach my $db ('db1', 'db2')
+{
+	$node->psql($db, "select logging.test_ereport('error', 'from $db', 'd', 'h')");
+}
+
+foreach my $db ('db1', 'db2')
+{
+	my $res = $node->safe_psql('postgres',
+		"select string_agg(message, ',') from logging.get_tenant_log($oid{$db}) " .
+		"where message like 'from %'");
+	is($res, "from $db", "only logs of $db are returned");
+}
+
+# an unknown database has no logs even if it shares a partition
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_tenant_log($oid{db1} + 4)"),
+	'0', 'no logs of other databases in the same partition');
+
+# tenant reads don't move the reading position
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message like 'from %'"),
+	'2', 'logs of both databases are still there');
+
+$node->stop;
@@ -0,0 +1,43 @@
+# levels split between tiers of the buffer with pg_logging.tier_split
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 3;
+
+my $node = get_new_node('tiers');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+pg_logging.buffer_size = 1024
+pg_logging.tier_split = '20,30,50'
+log_min_messages = notice
+});
+$node->start;
+
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+$node->psql('postgres', "select logging.test_ereport('error', 'keep me', 'd', 'h')");
+
+# much more notices than the whole buffer could keep
+$node->safe_psql('postgres', q{
+	set client_min_messages = warning;
+	do $$ begin
+		for i in 1..20000 loop
+			raise notice 'flood %', i;
+		end loop;
+	end $$;
+});
+
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message = 'keep me'"),
+	'1', 'the error is not evicted by notices');
+
+my $flood = $node->safe_psql('postgres',
+	"select count(*) from logging.get_log(false) where message like 'flood %'");
+ok($flood > 0 && $flood < 20000, 'notices wrapped their own tier');
+
+is($node->safe_psql('postgres',
+		"select max(message) from logging.get_log(false) where message like 'flood 2000_'"),
+	'flood 20000', 'the newest notice is kept');
+
+$node->stop;
@@ -0,0 +1,50 @@
+# loading logs to a table partitioned by days with pg_logging.load_database
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 4;
+
+my $node = get_new_node('loader');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+});
+$node->start;
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+$node->stop;
+
+# the worker needs the extension, so it's enabled after the extension is created
+$node->append_conf('postgresql.conf', qq{
+pg_logging.load_database = 'postgres'
+pg_logging.load_interval = 100
+pg_logging.load_batch_size = 10
+});
+$node->start;
+
+foreach my $i (1 .. 25)
+{
+	$node->psql('postgres', "select logging.test_ereport('error', 'to archive $i', 'd', 'h')");
+}
+
+ok($node->poll_query_until('postgres',
+		"select count(*) = 25 from logging.log_archive where message like 'to archive %'"),
+	'logs are loaded in several batches');
+
+is($node->safe_psql('postgres',
+		"select count(*) from logging.log_archive where message = 'to archive 7'"),
+	'1', 'each log is loaded once');
+
+my $today = $node->safe_psql('postgres',
+	"select to_char(now() at time zone 'utc', 'YYYYMMDD')");
+is($node->safe_psql('postgres',
+		"select count(*) from logging.log_archive_$today " .
+		"where message like 'to archive %'"),
+	'25', 'logs are in the partition of today');
+
+# loading doesn't move the reading position
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message like 'to archive %'"),
+	'25', 'logs are still in the buffer');
+
+$node->stop;
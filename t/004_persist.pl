@@ -0,0 +1,39 @@
+# saving the buffer on shutdown with pg_logging.persist
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 3;
+
+my $node = get_new_node('persist');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+});
+$node->start;
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+
+# persist is off by default
+$node->psql('postgres', "select logging.test_ereport('error', 'not saved', 'd', 'h')");
+$node->restart;
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message = 'not saved'"),
+	'0', 'logs are not saved by default');
+
+$node->append_conf('postgresql.conf', qq{
+pg_logging.persist = on
+});
+$node->reload;
+$node->psql('postgres', "select logging.test_ereport('error', 'saved', 'd', 'h')");
+$node->restart;
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message = 'saved'"),
+	'1', 'logs survive restart');
+
+# the loaded logs are saved again on the next shutdown, not duplicated
+$node->restart;
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message = 'saved'"),
+	'1', 'logs are not duplicated');
+
+$node->stop;
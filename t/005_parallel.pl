@@ -0,0 +1,48 @@
+# get_log_partial parts read by workers of Parallel Append
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $node = get_new_node('parallel');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+});
+$node->start;
+
+if ($node->safe_psql('postgres', 'show server_version_num') < 110000)
+{
+	$node->stop;
+	plan skip_all => 'Parallel Append appeared in PostgreSQL 11';
+}
+plan tests => 3;
+
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+
+foreach my $i (1 .. 20)
+{
+	$node->psql('postgres', "select logging.test_ereport('error', 'part $i', 'd', 'h')");
+}
+
+my $settings = 'set parallel_setup_cost = 0; set parallel_tuple_cost = 0; '
+	. 'set max_parallel_workers_per_gather = 4;';
+my $query = 'select message from logging.get_log_partial(0, 4) '
+	. 'union all select message from logging.get_log_partial(1, 4) '
+	. 'union all select message from logging.get_log_partial(2, 4) '
+	. 'union all select message from logging.get_log_partial(3, 4)';
+
+my $plan = $node->safe_psql('postgres', "$settings explain (costs off) $query");
+like($plan, qr/Gather.*Parallel Append/s, 'parts are read by Parallel Append');
+
+is($node->safe_psql('postgres',
+		"$settings select count(*) from ($query) q where message like 'part %'"),
+	'20', 'parts return all logs');
+
+# the reading position is not moved by parts
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message like 'part %'"),
+	'20', 'logs are still in the buffer');
+
+$node->stop;
@@ -0,0 +1,44 @@
+# load shedding when the buffer wraps sooner than pg_logging.shed_horizon
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 4;
+
+my $node = get_new_node('shedding');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+pg_logging.buffer_size = 1024
+pg_logging.shed_horizon = '1h'
+});
+$node->start;
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+
+# the first flood sheds debug levels, a second later LOG is shed too
+$node->safe_psql('postgres', "select logging.bench_log_hook(20000, 'log')");
+is($node->safe_psql('postgres',
+		'select shed_level is not null, raised > 0 from logging.get_shedding_stats()'),
+	't|t', 'shedding is raised after the buffer wraps');
+
+$node->safe_psql('postgres', 'select pg_sleep(1.1)');
+$node->safe_psql('postgres', "select logging.bench_log_hook(20000, 'log')");
+is($node->safe_psql('postgres',
+		'select raised > 1, shed > 0 from logging.get_shedding_stats()'),
+	't|t', 'LOG is shed in the second flood');
+
+# errors are never shed
+$node->psql('postgres', "select logging.test_ereport('error', 'kept', 'd', 'h')");
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message = 'kept'"),
+	'1', 'errors are kept');
+
+# without the horizon the levels are restored one by one
+$node->safe_psql('postgres',
+	"set pg_logging.shed_horizon = 0; select pg_sleep(1.1); " .
+	"select logging.bench_log_hook(1, 'log')");
+is($node->safe_psql('postgres',
+		'select relaxed from logging.get_shedding_stats()'),
+	'1', 'shedding is relaxed by one level');
+
+$node->stop;
@@ -0,0 +1,82 @@
+# reading binary frames sent by the exporter to a Unix socket
+use strict;
+use warnings;
+use IO::Socket::UNIX;
+use Socket qw(SOCK_STREAM);
+use PostgresNode;
+use TestLib;
+use Test::More tests => 10;
+
+my $path = TestLib::tempdir_short() . '/export.sock';
+my $listener = IO::Socket::UNIX->new(
+	Type => SOCK_STREAM,
+	Local => $path,
+	Listen => 1) or die "could not listen on $path: $!";
+
+my $node = get_new_node('export');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+pg_logging.export_path = '$path'
+pg_logging.export_format = 'binary'
+pg_logging.export_interval = 100
+pg_logging.store_templates = on
+});
+$node->start;
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+$node->psql('postgres',
+	"select logging.test_ereport('error', 'binary frame', 'some detail', 'some hint')");
+
+# the message is the same as its format, so only the template is stored
+$node->psql('postgres', 'select 1/0');
+
+# reads exactly $len bytes from the collector socket
+sub read_bytes
+{
+	my ($sock, $len) = @_;
+	my $buf = '';
+
+	while (length($buf) < $len)
+	{
+		my $n = sysread($sock, $buf, $len - length($buf), length($buf));
+		die "could not read from the exporter: $!" unless $n;
+	}
+	return $buf;
+}
+
+my %frames;
+eval {
+	local $SIG{ALRM} = sub { die "timed out\n" };
+	alarm(180);
+
+	my $sock = $listener->accept or die "could not accept: $!";
+	for (;;)
+	{
+		my $len = unpack('N', read_bytes($sock, 4));
+		my @f = unpack('C q> q> l> l> q> N N l> N l> l> l> N q> (N/a)22',
+			read_bytes($sock, $len));
+
+		$frames{$f[15]} = \@f;
+		last if $frames{'binary frame'} && $frames{'division by zero'};
+	}
+	alarm(0);
+};
+is($@, '', 'frames are received');
+
+my ($version, $log_time, $start_time, $level, $pid, $line_num, $datid,
+	$userid, $errno, $txid, $query_pos, $internalpos, $lineno, $repeat_count,
+	$last_log_time, @texts) = @{ $frames{'binary frame'} || [] };
+
+is($version, 1, 'format version');
+ok(abs($log_time / 1000000 - time()) < 3600, 'log time is in Unix epoch');
+is($level, 20, 'level');
+is($texts[1], 'some detail', 'detail follows the message');
+is($texts[8], '0A000', 'errstate');
+like($texts[19], qr/\.c$/, 'interned file name is resolved');
+is($texts[20], 'test_ereport', 'interned function name is resolved');
+
+my @tmpl = @{ $frames{'division by zero'} || [] }[15 .. 36];
+is($tmpl[0], 'division by zero', 'templated message is resolved');
+is($tmpl[21], 'division by zero', 'message template');
+
+$node->stop;
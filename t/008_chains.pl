@@ -0,0 +1,36 @@
+# logs of backends which disconnected, by get_log_for_pid
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 2;
+
+my $node = get_new_node('chains');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+});
+$node->start;
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+
+my $pid = $node->safe_psql('postgres',
+	"select pg_backend_pid(); " .
+	"select logging.test_ereport('warning', 'from exited backend', 'd', 'h')");
+$pid = (split /\n/, $pid)[0];
+
+# new backends take the PGPROC of the exited one, and log too
+foreach my $i (1 .. 5)
+{
+	$node->safe_psql('postgres',
+		"select logging.test_ereport('warning', 'from backend $i', 'd', 'h')");
+}
+
+is($node->safe_psql('postgres',
+		"select message from logging.get_log_for_pid($pid)"),
+	'from exited backend', 'logs of an exited backend are found by pid');
+
+is($node->safe_psql('postgres',
+		"select count(*) from logging.get_log(false) where message like 'from backend %'"),
+	'5', 'other backends logged');
+
+$node->stop;
@@ -0,0 +1,44 @@
+# the writer evicts only items it writes over
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 3;
+
+my $node = get_new_node('eviction');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+shared_preload_libraries = 'pg_logging'
+pg_logging.buffer_size = 1024
+log_min_messages = notice
+});
+$node->start;
+
+$node->safe_psql('postgres', 'create schema logging; create extension pg_logging schema logging');
+
+# many times more notices than the buffer could keep
+$node->safe_psql('postgres', q{
+	set client_min_messages = warning;
+	do $$ begin
+		for i in 1..50000 loop
+			raise notice 'flood %', lpad(i::text, 5, '0');
+		end loop;
+	end $$;
+});
+
+my ($count, $oldest, $newest) = split /\|/, $node->safe_psql('postgres', q{
+	select count(*), min(substr(message, 7)::int), max(substr(message, 7)::int)
+	from logging.get_log(false) where message like 'flood %'});
+
+is($newest, 50000, 'the newest notice is kept');
+is($count, $newest - $oldest + 1, 'kept notices go one after another');
+
+is($node->safe_psql('postgres', q{
+	select count(*) from (
+		select * from logging.get_log_partial(0, 3)
+		union all select * from logging.get_log_partial(1, 3)
+		union all select * from logging.get_log_partial(2, 3)) p
+	where message like 'flood %'}),
+	$count, 'parts find items next to the newest ones');
+
+$node->stop;